@@ -80,8 +80,9 @@ typedef struct activity_record_s {
   };
   union {
     struct {
-      int device_id;     /* device id */
-      uint64_t queue_id; /* queue id */
+      int device_id;      /* device id */
+      uint32_t string_id; /* interned string id, 0 if none */
+      uint64_t queue_id;  /* queue id */
     };
     struct {
       uint32_t process_id; /* device id */
@@ -95,6 +96,8 @@ typedef struct activity_record_s {
     size_t bytes;            /* data size bytes */
     const char* kernel_name; /* kernel name */
     const char* mark_message;
+    const char* string;      /* interned string definition */
+    size_t records_lost;     /* number of records lost */
   };
 } activity_record_t;
 
@@ -0,0 +1,90 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+/* Layout of the shared memory segment of a memory pool created with
+   ROCTRACER_POOL_MODE_SHARED_MEMORY.
+
+   The segment is a file mapped by the traced process, made of a header of
+   'header_size' bytes followed by a ring of 'ring_size' bytes. The traced
+   process is the only writer of the ring, and a collector process is the only
+   reader.
+
+   The ring holds chunks, each made of a 64-bit chunk header and a payload. The
+   chunk header is the payload size in bytes, with ROCTRACER_SHM_CHUNK_PADDING
+   set if the chunk only pads the ring up to its end and must be skipped. Each
+   chunk starts at a multiple of 8 bytes and never wraps around the end of the
+   ring, so its size is 8 + the payload size rounded up to a multiple of 8.
+
+   The write and read offsets count the bytes written to and read from the ring
+   since it was created, a chunk starts at ring offset (offset % ring_size).
+   The writer fills a chunk, then stores the new write offset with release
+   semantics. The reader loads the write offset with acquire semantics,
+   processes the chunks up to it, then stores the new read offset with release
+   semantics. The writer does not overwrite chunks until the reader moved the
+   read offset past them.
+
+   The payload of a chunk is a sequence of activity records, roctracer_record_t
+   structures, or compact records if ROCTRACER_SHM_FLAG_COMPACT_RECORDS is set
+   (see roctracer_next_compact_record). An ACTIVITY_EXT_OP_STRING_DEFINITION
+   record is directly followed by its null-terminated string, padded with zeros
+   to a multiple of 8 bytes, and its 'string' field is NULL. Other pointers in
+   the records are addresses in the traced process. */
+
+#ifndef EXT_SHM_PROTOCOL_H_
+#define EXT_SHM_PROTOCOL_H_
+
+#include <stdint.h>
+
+/* "ROCTRSHM" */
+#define ROCTRACER_SHM_MAGIC UINT64_C(0x4d48535254434f52)
+#define ROCTRACER_SHM_VERSION 1
+
+/* The records are encoded in the compact record encoding. */
+#define ROCTRACER_SHM_FLAG_COMPACT_RECORDS (1u << 0)
+
+/* Set in a chunk header if the chunk is padding. */
+#define ROCTRACER_SHM_CHUNK_PADDING (UINT64_C(1) << 63)
+
+typedef struct roctracer_shm_header_s {
+  /* Written by the writer when the segment is created. The magic is written
+     last, with release semantics. */
+  uint64_t magic;
+  uint32_t version;
+  uint32_t flags;        /* ROCTRACER_SHM_FLAG_* */
+  uint64_t header_size;  /* offset of the ring in the segment */
+  uint64_t ring_size;    /* size of the ring, a power of 2 */
+  uint64_t time_base_ns; /* time base of the compact records */
+  uint32_t writer_pid;
+  uint32_t reserved0;
+  uint8_t padding0[16];
+
+  /* Written by the writer. */
+  uint64_t write_offset;
+  uint64_t records_lost; /* records dropped because the ring was full */
+  uint32_t closed;       /* non-zero once the writer is done */
+  uint32_t reserved1;
+  uint8_t padding1[40];
+
+  /* Written by the reader. */
+  uint64_t read_offset;
+  uint8_t padding2[56];
+} roctracer_shm_header_t;
+
+#endif /* EXT_SHM_PROTOCOL_H_ */
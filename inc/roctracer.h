@@ -109,6 +109,12 @@ extern "C" {
  */
 #define ROCTRACER_VERSION_4_1
 
+/**
+ * The function was introduced in version 4.2 of the interface and has the
+ * symbol version string of ``"ROCTRACER_4.2"``.
+ */
+#define ROCTRACER_VERSION_4_2
+
 /** @} */
 
 /** \defgroup versioning_group Versioning
@@ -134,7 +140,7 @@ extern "C" {
  * The minor version of the interface as a macro so it can be used by the
  * preprocessor.
  */
-#define ROCTRACER_VERSION_MINOR 1
+#define ROCTRACER_VERSION_MINOR 2
 
 /**
  * Query the major version of the installed library.
@@ -388,6 +394,35 @@ ROCTRACER_API roctracer_status_t roctracer_enable_domain_callback(
     activity_domain_t domain, activity_rtapi_callback_t callback,
     void* arg) ROCTRACER_VERSION_4_1;
 
+/**
+ * Enable runtime API callbacks for a list of operations of a domain.
+ *
+ * The operations are registered in one step: the list is validated before
+ * any operation is enabled, and the tracer is engaged at most once.
+ *
+ * @param domain The domain.
+ *
+ * @param ops The operations in \p domain.
+ *
+ * @param op_count The number of operations in \p ops.
+ *
+ * @param callback The callback to invoke each time the operation is performed
+ * on entry and exit.
+ *
+ * @param arg Value to pass as last argument of \p callback.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_DOMAIN_ID \p domain is invalid.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT An operation of \p ops is
+ * invalid for \p domain, or \p ops is NULL and \p op_count is not 0.
+ */
+ROCTRACER_API roctracer_status_t roctracer_enable_ops_callback(
+    activity_domain_t domain, const uint32_t* ops, uint32_t op_count,
+    activity_rtapi_callback_t callback, void* arg) ROCTRACER_VERSION_4_2;
+
 /**
  * Disable runtime API callback for a specific operation of a domain.
  *
@@ -419,6 +454,27 @@ ROCTRACER_API roctracer_status_t roctracer_disable_op_callback(
 ROCTRACER_API roctracer_status_t roctracer_disable_domain_callback(
     activity_domain_t domain) ROCTRACER_VERSION_4_1;
 
+/**
+ * Disable runtime API callbacks for a list of operations of a domain.
+ *
+ * @param domain The domain.
+ *
+ * @param ops The operations in \p domain.
+ *
+ * @param op_count The number of operations in \p ops.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_DOMAIN_ID \p domain is invalid.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT An operation of \p ops is
+ * invalid for \p domain, or \p ops is NULL and \p op_count is not 0.
+ */
+ROCTRACER_API roctracer_status_t roctracer_disable_ops_callback(
+    activity_domain_t domain, const uint32_t* ops,
+    uint32_t op_count) ROCTRACER_VERSION_4_2;
+
 /** @} */
 
 /** \defgroup activity_api_group Activity API
@@ -456,6 +512,34 @@ ROCTRACER_API roctracer_status_t
 roctracer_next_record(const activity_record_t* record,
                       const activity_record_t** next) ROCTRACER_VERSION_4_1;
 
+/**
+ * Decode the next activity record of a memory pool buffer in compact records
+ * mode.
+ *
+ * A memory pool created with ::ROCTRACER_POOL_MODE_COMPACT_RECORDS generates
+ * buffers that contain multiple encoded activity records.  This function
+ * decodes the activity record at \p *record and steps to the next one.
+ *
+ * @param[in,out] record Pointer to an encoded activity record in a memory
+ * pool buffer, updated to point to the following encoded activity record.
+ *
+ * @param[in] end The end of the memory pool buffer.
+ *
+ * @param[in] time_base_ns The \p time_base_ns property of the memory pool.
+ *
+ * @param[out] decoded The decoded activity record.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT \p record or \p decoded is
+ * NULL, \p *record is not before \p end, or the encoded activity record is
+ * truncated.
+ */
+ROCTRACER_API roctracer_status_t roctracer_next_compact_record(
+    const char** record, const char* end, uint64_t time_base_ns,
+    activity_record_t* decoded) ROCTRACER_VERSION_4_2;
+
 /**
  * Memory pool allocator callback.
  *
@@ -492,14 +576,99 @@ typedef void (*roctracer_allocator_t)(char** ptr, size_t size, void* arg);
 typedef void (*roctracer_buffer_callback_t)(const char* begin, const char* end,
                                             void* arg);
 
+/**
+ * Memory pool modes.
+ *
+ * The modes are bit flags that can be combined in the \p mode field of
+ * ::roctracer_properties_t.
+ */
+typedef enum {
+  /**
+   * Each producer thread appends its records to a private buffer without
+   * taking the pool lock.  The buffers are handed to the buffer callback when
+   * they are full or when the pool is flushed, so records written by different
+   * threads are not delivered in the order they were written.
+   */
+  ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS = 1 << 0,
+  /**
+   * Allocate the buffers with \p mmap, backed by explicit huge pages if any
+   * are reserved, or by transparent huge pages otherwise, and fault the pages
+   * in when the pool is created.  Ignored if \p alloc_fun is not NULL.
+   */
+  ROCTRACER_POOL_MODE_HUGE_PAGES = 1 << 1,
+  /**
+   * Allocate the buffers with \p mmap and bind them to the NUMA node given by
+   * the \p numa_node field of ::roctracer_properties_t, and fault the pages in
+   * when the pool is created.  Ignored if \p alloc_fun is not NULL.
+   */
+  ROCTRACER_POOL_MODE_NUMA_BIND = 1 << 2,
+  /**
+   * Store the activity records in a compact, variable-length encoding instead
+   * of as ::roctracer_record_t structures.  The buffers handed to the buffer
+   * callback must be decoded with ::roctracer_next_compact_record.  The fields
+   * not used by the domain of a record are not preserved.
+   */
+  ROCTRACER_POOL_MODE_COMPACT_RECORDS = 1 << 3,
+  /**
+   * Publish the records to a shared memory segment, the file given by the \p
+   * shared_memory_path field of ::roctracer_properties_t, instead of handing
+   * them to the \p buffer_callback_fun callback, so that they can be
+   * processed by another process, for example the roctracer_collector tool.
+   * The records published to the segment are kept in the file if the process
+   * terminates.  The layout of the segment is described in
+   * ext/shm_protocol.h.  If the segment is full, the records are dropped and
+   * counted in the segment header.  With the ::ROCTRACER_POOL_OVERFLOW_BLOCK
+   * policy, the records are only dropped if the reader does not free space in
+   * the segment within 1 second, and then without waiting until the reader
+   * frees space again, so that a missing reader does not block the memory
+   * pool.
+   */
+  ROCTRACER_POOL_MODE_SHARED_MEMORY = 1 << 4
+} roctracer_pool_mode_t;
+
+/**
+ * Memory pool overflow policies.
+ *
+ * Defines what a producer does when it needs a new buffer and all the buffers
+ * of the pool are waiting to be processed by the buffer callback.  Records
+ * dropped by a policy are counted per domain, see
+ * ::roctracer_pool_get_dropped_records, and reported in-band with an
+ * ::ACTIVITY_EXT_OP_RECORDS_LOST record written before the next delivered
+ * record.
+ */
+typedef enum {
+  /**
+   * Wait for the buffer callback to release a buffer.  No record is lost.
+   */
+  ROCTRACER_POOL_OVERFLOW_BLOCK = 0,
+  /**
+   * Drop the record being written.
+   */
+  ROCTRACER_POOL_OVERFLOW_DROP_NEWEST = 1,
+  /**
+   * Drop the records of the oldest buffer not yet handed to the buffer
+   * callback, and reuse that buffer for the record being written.  If all the
+   * buffers are either being written or processed by the callback, the record
+   * being written is dropped.
+   */
+  ROCTRACER_POOL_OVERFLOW_DROP_OLDEST = 2
+} roctracer_pool_overflow_policy_t;
+
 /**
  * Memory pool properties.
  *
  * Defines the properties when a tracer memory pool is created.
+ *
+ * The fields following \p buffer_callback_arg were added in version 4.2 of the
+ * interface, along with the ``"ROCTRACER_4.2"`` versions of
+ * ::roctracer_open_pool and ::roctracer_open_pool_expl.  The earlier versions
+ * of these functions only read the fields up to \p buffer_callback_arg, and
+ * create the pool as if the other fields were 0.
  */
 typedef struct {
   /**
-   * ROC Tracer mode.
+   * ROC Tracer mode.  A combination of ::roctracer_pool_mode_t flags, or 0 for
+   * the default mode.
    */
   uint32_t mode;
 
@@ -528,8 +697,167 @@ typedef struct {
    * The argument to pass when invoking the \p buffer_callback_fun callback.
    */
   void* buffer_callback_arg;
+
+  /**
+   * Number of buffers of \p buffer_size bytes in the pool.  Full buffers are
+   * queued for the \p buffer_callback_fun callback, and producers only wait
+   * for the callback when all the buffers are queued.  If less than 2, the
+   * pool is double buffered.
+   */
+  size_t buffer_count;
+
+  /**
+   * What to do when all the buffers are waiting for the \p buffer_callback_fun
+   * callback.  Flushing the pool always waits for free buffers.
+   */
+  roctracer_pool_overflow_policy_t overflow_policy;
+
+  /**
+   * The NUMA node to allocate the buffers on if the mode includes
+   * ::ROCTRACER_POOL_MODE_NUMA_BIND.  If negative, the node of the CPU that
+   * creates the pool is used.
+   */
+  int numa_node;
+
+  /**
+   * If not 0, the records written to the memory pool are handed to the \p
+   * buffer_callback_fun callback at least every \p flush_interval_ns
+   * nanoseconds, even if the buffers are not full.  The flushes are performed
+   * by the consumer threads, see ::roctracer_configure_consumer_threads.
+   */
+  uint64_t flush_interval_ns;
+
+  /**
+   * The timestamp the record timestamps are encoded relative to if the mode
+   * includes ::ROCTRACER_POOL_MODE_COMPACT_RECORDS.  The records are the most
+   * compact if this is the time the memory pool is created, see
+   * ::roctracer_get_timestamp.  The same value must be passed to
+   * ::roctracer_next_compact_record.
+   */
+  uint64_t time_base_ns;
+
+  /**
+   * The path of the shared memory segment file to create if the mode includes
+   * ::ROCTRACER_POOL_MODE_SHARED_MEMORY, for example a file in /dev/shm.  An
+   * existing file is replaced.
+   */
+  const char* shared_memory_path;
+
+  /**
+   * The size in bytes of the ring of the shared memory segment.  It is rounded
+   * up to a power of 2, and to at least twice the buffer size.
+   */
+  size_t shared_memory_size;
 } roctracer_properties_t;
 
+/**
+ * Memory pool statistics.
+ *
+ * Returned by ::roctracer_pool_get_stats.  The counters are cumulative since
+ * the memory pool was created, unless noted otherwise.
+ */
+typedef struct {
+  /**
+   * The number of activity records written to the memory pool, including the
+   * records dropped by the overflow policy after being written.
+   */
+  uint64_t records;
+
+  /**
+   * The number of bytes written to the memory pool buffers, including the
+   * data copied with the records.
+   */
+  uint64_t bytes;
+
+  /**
+   * The number of partially filled buffers handed to the buffer callback by
+   * explicit or periodic flushes.
+   */
+  uint64_t flushes;
+
+  /**
+   * The number of full buffers handed to the buffer callback.  In per-thread
+   * buffers mode, this includes the buffers of the exited threads.
+   */
+  uint64_t buffer_switches;
+
+  /**
+   * The total time, in nanoseconds, that the producer threads were blocked
+   * waiting for the buffer callback to release a buffer or to process
+   * records.
+   */
+  uint64_t producer_wait_ns;
+
+  /**
+   * The number of calls to the buffer callback.
+   */
+  uint64_t callbacks;
+
+  /**
+   * The total time, in nanoseconds, spent in the buffer callback.
+   */
+  uint64_t callback_ns;
+
+  /**
+   * The longest time, in nanoseconds, spent in a single buffer callback call.
+   */
+  uint64_t max_callback_ns;
+
+  /**
+   * The number of bytes of records currently waiting for, or being processed
+   * by, the buffer callback.
+   */
+  uint64_t queued_bytes;
+
+  /**
+   * The highest value of \p queued_bytes since the memory pool was created.
+   */
+  uint64_t max_queued_bytes;
+
+  /**
+   * The number of activity records dropped by the overflow policy, of all
+   * domains.
+   */
+  uint64_t dropped_records;
+} roctracer_pool_stats_t;
+
+/**
+ * The consumer thread count starting a consumer thread for each memory pool,
+ * see ::roctracer_configure_consumer_threads.
+ */
+#define ROCTRACER_CONSUMER_THREADS_PER_POOL UINT32_MAX
+
+/**
+ * Configure the threads processing the buffers of all the memory pools.
+ *
+ * The buffers of all the memory pools are processed by a shared set of
+ * consumer threads.  The buffers of a memory pool are processed in order, by
+ * one thread at a time.  The threads are started when the first buffer is
+ * handed to a buffer callback, and can only be configured before that.  By
+ * default, a thread is started for each memory pool, up to a quarter of the
+ * CPUs.  With less threads than memory pools, a slow buffer callback delays
+ * the other memory pools, and a buffer callback that waits for the buffers of
+ * another memory pool to be processed may deadlock if all the threads are
+ * busy.  ::ROCTRACER_CONSUMER_THREADS_PER_POOL starts a thread for each
+ * memory pool instead.
+ *
+ * @param[in] thread_count The number of consumer threads, 0 for the default,
+ * or ::ROCTRACER_CONSUMER_THREADS_PER_POOL.
+ *
+ * @param[in] cpus If not NULL, the array of \p cpu_count CPUs the consumer
+ * threads may run on.  If NULL, the consumer threads may run on any CPU.
+ *
+ * @param[in] cpu_count The number of CPUs in \p cpus.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR The consumer threads are already started.
+ */
+ROCTRACER_API roctracer_status_t roctracer_configure_consumer_threads(
+    uint32_t thread_count, const uint32_t* cpus,
+    uint32_t cpu_count) ROCTRACER_VERSION_4_2;
+
 /**
  * Tracer memory pool type.
  */
@@ -559,7 +887,7 @@ typedef void roctracer_pool_t;
  */
 ROCTRACER_API roctracer_status_t
 roctracer_open_pool_expl(const roctracer_properties_t* properties,
-                         roctracer_pool_t** pool) ROCTRACER_VERSION_4_1;
+                         roctracer_pool_t** pool) ROCTRACER_VERSION_4_2;
 
 /**
  * Create tracer memory pool.
@@ -579,7 +907,7 @@ roctracer_open_pool_expl(const roctracer_properties_t* properties,
  * for the \p pool. Unable to create the pool.
  */
 ROCTRACER_API roctracer_status_t roctracer_open_pool(
-    const roctracer_properties_t* properties) ROCTRACER_VERSION_4_1;
+    const roctracer_properties_t* properties) ROCTRACER_VERSION_4_2;
 
 /**
  * Close tracer memory pool.
@@ -697,6 +1025,35 @@ ROCTRACER_API roctracer_status_t roctracer_enable_domain_activity_expl(
 ROCTRACER_API roctracer_status_t roctracer_enable_domain_activity(
     activity_domain_t domain) ROCTRACER_VERSION_4_1;
 
+/**
+ * Enable activity record logging for a list of operations of a domain
+ * providing a memory pool.
+ *
+ * The operations are registered in one step: the list is validated before
+ * any operation is enabled, and the tracer is engaged at most once.
+ *
+ * @param[in] domain The domain.
+ *
+ * @param[in] ops The activity operation IDs in \p domain.
+ *
+ * @param[in] op_count The number of operations in \p ops.
+ *
+ * @param[in] pool The memory pool to write the activity record. If NULL, use
+ * the default memory pool.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT An operation of \p ops is
+ * invalid for \p domain, or \p ops is NULL and \p op_count is not 0.
+ *
+ * @retval ROCTRACER_STATUS_ERROR \p pool is NULL and no default pool is
+ * defined.
+ */
+ROCTRACER_API roctracer_status_t roctracer_enable_ops_activity_expl(
+    activity_domain_t domain, const uint32_t* ops, uint32_t op_count,
+    roctracer_pool_t* pool) ROCTRACER_VERSION_4_2;
+
 /**
  * Disable activity record logging for a specified operation of a domain.
  *
@@ -721,6 +1078,25 @@ ROCTRACER_API roctracer_status_t roctracer_disable_op_activity(
 ROCTRACER_API roctracer_status_t roctracer_disable_domain_activity(
     activity_domain_t domain) ROCTRACER_VERSION_4_1;
 
+/**
+ * Disable activity record logging for a list of operations of a domain.
+ *
+ * @param[in] domain The domain.
+ *
+ * @param[in] ops The activity operation IDs in \p domain.
+ *
+ * @param[in] op_count The number of operations in \p ops.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT An operation of \p ops is
+ * invalid for \p domain, or \p ops is NULL and \p op_count is not 0.
+ */
+ROCTRACER_API roctracer_status_t roctracer_disable_ops_activity(
+    activity_domain_t domain, const uint32_t* ops,
+    uint32_t op_count) ROCTRACER_VERSION_4_2;
+
 /**
  * Flush available activity records for a memory pool.
  *
@@ -750,6 +1126,176 @@ roctracer_flush_activity_expl(roctracer_pool_t* pool) ROCTRACER_VERSION_4_1;
 ROCTRACER_API roctracer_status_t roctracer_flush_activity()
     ROCTRACER_VERSION_4_1;
 
+/**
+ * Asynchronous flush completion callback function type.
+ *
+ * @param[in] arg The argument passed to ::roctracer_flush_activity_async.
+ */
+typedef void (*roctracer_flush_callback_t)(void* arg);
+
+/**
+ * Flush the activity records of a memory pool without waiting for them to be
+ * processed.
+ *
+ * The activity records written before the call are handed to the buffer
+ * callback of the memory pool, and the function returns without waiting for
+ * the buffer callback to process them.
+ *
+ * @param[in] pool The memory pool to flush. If NULL, flushes the default
+ * memory pool.
+ *
+ * @param[in] completion_cb If not NULL, the function called from the memory
+ * pool's consumer thread once the buffer callback has processed all the
+ * activity records written before the call.
+ *
+ * @param[in] arg The argument to pass to \p completion_cb.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ */
+ROCTRACER_API roctracer_status_t roctracer_flush_activity_async(
+    roctracer_pool_t* pool, roctracer_flush_callback_t completion_cb,
+    void* arg) ROCTRACER_VERSION_4_2;
+
+/**
+ * Query the number of activity records dropped by the overflow policy of a
+ * memory pool.
+ *
+ * @param[in] pool The memory pool to query. If NULL, queries the default
+ * memory pool.
+ *
+ * @param[in] domain The domain of the dropped records.
+ *
+ * @param[out] count The number of records of \p domain dropped since the
+ * memory pool was created.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_DOMAIN_ID \p domain is invalid.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT \p count is NULL.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED \p pool is NULL and
+ * no default pool is defined.
+ */
+ROCTRACER_API roctracer_status_t roctracer_pool_get_dropped_records(
+    roctracer_pool_t* pool, activity_domain_t domain, uint64_t* count)
+    ROCTRACER_VERSION_4_2;
+
+/**
+ * Query the throughput, fill level and stall statistics of a memory pool.
+ *
+ * The statistics are a snapshot, and may be slightly inconsistent with each
+ * other if activity records are written concurrently.
+ *
+ * @param[in] pool The memory pool to query. If NULL, queries the default
+ * memory pool.
+ *
+ * @param[out] stats The statistics of the memory pool.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT \p stats is NULL.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED \p pool is NULL and
+ * no default pool is defined.
+ */
+ROCTRACER_API roctracer_status_t
+roctracer_pool_get_stats(roctracer_pool_t* pool,
+                         roctracer_pool_stats_t* stats) ROCTRACER_VERSION_4_2;
+
+/**
+ * Reserve activity records in a memory pool, to be filled in place.
+ *
+ * The reserved records are contiguous and zero-initialized.  Once filled, they
+ * must be committed with ::roctracer_pool_commit_records.  The committed
+ * records are handed to the buffer callback together, after the records
+ * written before the reservation and before the records written after it.
+ *
+ * No lock is held between the reservation and the commit: other records can
+ * be written to the memory pool in between, including by the calling thread.
+ * The records following a reservation are not held back by it: flushing the
+ * memory pool skips the reservations pending commit, and their records are
+ * handed to the buffer callback on their own once committed.  A reservation
+ * no longer needed is released with ::roctracer_pool_cancel_records.  The
+ * buffer holding a reservation is only reused once the reservation is
+ * committed or cancelled, so with the ::ROCTRACER_POOL_OVERFLOW_BLOCK policy,
+ * writers wait for a reservation to complete if all the buffers of the memory
+ * pool hold one.
+ *
+ * @param[in] pool The memory pool to reserve the records in. If NULL, uses the
+ * default memory pool.
+ *
+ * @param[in] domain The domain accounted for the records if they are dropped,
+ * see ::roctracer_pool_get_dropped_records.
+ *
+ * @param[in] count The number of records to reserve.  The records must fit in
+ * one buffer of the memory pool.
+ *
+ * @param[out] records The reserved records, or NULL if the records are dropped
+ * by the overflow policy of the memory pool.  Dropped records must not be
+ * committed.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_DOMAIN_ID \p domain is invalid.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT \p records is NULL, or
+ * \p count is 0 or larger than the number of records fitting in a buffer.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED \p pool is NULL and
+ * no default pool is defined.
+ */
+ROCTRACER_API roctracer_status_t roctracer_pool_reserve_records(
+    roctracer_pool_t* pool, activity_domain_t domain, size_t count,
+    roctracer_record_t** records) ROCTRACER_VERSION_4_2;
+
+/**
+ * Commit the activity records reserved with ::roctracer_pool_reserve_records.
+ *
+ * @param[in] pool The memory pool the records were reserved in. If NULL, uses
+ * the default memory pool.
+ *
+ * @param[in] records The reserved records.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT \p records is NULL, or is
+ * not a reservation of \p pool pending commit.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED \p pool is NULL and
+ * no default pool is defined.
+ */
+ROCTRACER_API roctracer_status_t roctracer_pool_commit_records(
+    roctracer_pool_t* pool, roctracer_record_t* records) ROCTRACER_VERSION_4_2;
+
+/**
+ * Cancel the activity records reserved with ::roctracer_pool_reserve_records.
+ *
+ * The cancelled records are not handed to the buffer callback, and are no
+ * longer accounted in the statistics of the memory pool.
+ *
+ * @param[in] pool The memory pool the records were reserved in. If NULL, uses
+ * the default memory pool.
+ *
+ * @param[in] records The reserved records.
+ *
+ * @retval ::ROCTRACER_STATUS_SUCCESS The function has been executed
+ * successfully.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT \p records is NULL, or is
+ * not a reservation of \p pool pending commit.
+ *
+ * @retval ::ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED \p pool is NULL and
+ * no default pool is defined.
+ */
+ROCTRACER_API roctracer_status_t roctracer_pool_cancel_records(
+    roctracer_pool_t* pool, roctracer_record_t* records) ROCTRACER_VERSION_4_2;
+
 /** @} */
 
 /** \defgroup timestamp_group Timestamp Operations
@@ -35,9 +35,23 @@
 /* Extension API opcodes */
 typedef enum {
   ACTIVITY_EXT_OP_MARK = 0,
-  ACTIVITY_EXT_OP_EXTERN_ID = 1
+  ACTIVITY_EXT_OP_EXTERN_ID = 1,
+  /* Records dropped by a memory pool overflow policy. The record kind is the
+     domain of the dropped records, and records_lost is their number. */
+  ACTIVITY_EXT_OP_RECORDS_LOST = 2,
+  /* Definition of an interned string, delivered once per memory pool before
+     or along with the first records referring to the string by its id. The
+     record string_id is the id of the string, and string is the string. */
+  ACTIVITY_EXT_OP_STRING_DEFINITION = 3
 } activity_ext_op_t;
 
+/* Opaque snapshot of the correlation context of a thread: its current
+   correlation ID and external correlation ID. See
+   roctracer_correlation_context_capture. */
+typedef struct {
+  uint64_t opaque[2];
+} roctracer_correlation_context_t;
+
 typedef void (*roctracer_start_cb_t)();
 typedef void (*roctracer_stop_cb_t)();
 typedef struct {
@@ -74,6 +88,32 @@ roctracer_status_t ROCTRACER_API
 roctracer_activity_pop_external_correlation_id(
     activity_correlation_id_t* last_id) ROCTRACER_VERSION_4_1;
 
+////////////////////////////////////////////////////////////////////////////////
+// Correlation context propagation API
+
+// Capture the correlation context of the calling thread: the correlation ID
+// of the API region the thread is in, and its current external correlation
+// id. The context can be restored on another thread, for example a worker
+// thread running a task submitted by the calling thread, so that the records
+// of the worker thread are attributed to the submitter. Does not allocate
+// memory.
+roctracer_status_t ROCTRACER_API roctracer_correlation_context_capture(
+    roctracer_correlation_context_t* context) ROCTRACER_VERSION_4_2;
+
+// Enter a region of the calling thread running on behalf of the captured
+// 'context': push its correlation ID and external correlation ID, if any,
+// onto the calling thread's stacks. The region must be ended with
+// roctracer_correlation_context_release.
+roctracer_status_t ROCTRACER_API roctracer_correlation_context_restore(
+    const roctracer_correlation_context_t* context) ROCTRACER_VERSION_4_2;
+
+// Leave the region entered by roctracer_correlation_context_restore with the
+// same 'context'.  If 'context' is not the last context restored by the
+// calling thread and not yet released, the thread's stacks are not changed and
+// ROCTRACER_STATUS_ERROR_MISMATCHED_EXTERNAL_CORRELATION_ID is returned.
+roctracer_status_t ROCTRACER_API roctracer_correlation_context_release(
+    const roctracer_correlation_context_t* context) ROCTRACER_VERSION_4_2;
+
 #ifdef __cplusplus
 }  // extern "C" block
 #endif  // __cplusplus
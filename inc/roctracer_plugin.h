@@ -44,6 +44,7 @@
 
 #include "roctracer.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -111,6 +112,34 @@ ROCTRACER_EXPORT void roctracer_plugin_finalize();
 ROCTRACER_EXPORT int roctracer_plugin_write_callback_record(
     const roctracer_record_t* record, const void* callback_data);
 
+/**
+ * Report a range of callback trace data.
+ *
+ * Reports \p count callback trace data with a single call. The records and
+ * their domain specific data are interleaved: the i-th record is at \p record
+ * plus i times \p stride bytes, and its domain specific data is at
+ * \p callback_data plus i times \p stride bytes.
+ *
+ * This operation is optional. If the plugin does not export it, the ROCtracer
+ * Tool reports the callback trace data one at a time with
+ * ::roctracer_plugin_write_callback_record.
+ *
+ * @param[in] record Primarily domain independent trace data of the first
+ * record.
+ *
+ * @param[in] callback_data Domain specific trace data of the first record.
+ *
+ * @param[in] count The number of records.
+ *
+ * @param[in] stride The distance in bytes between consecutive records, and
+ * between their domain specific data.
+ *
+ * @return Returns 0 on success and -1 on error.
+ */
+ROCTRACER_EXPORT int roctracer_plugin_write_callback_records(
+    const roctracer_record_t* record, const void* callback_data, size_t count,
+    size_t stride);
+
 /**
  * Report a range of activity trace data.
  *
@@ -248,56 +248,35 @@ class file_plugin_t {
 
   int write_callback_record(const roctracer_record_t* record, const void* callback_data) {
     std::stringstream ss;
-    output_file_t* output_file{nullptr};
-    switch (record->domain) {
-      case ACTIVITY_DOMAIN_ROCTX: {
-        const roctx_api_data_t* data = reinterpret_cast<const roctx_api_data_t*>(callback_data);
-        output_file = get_output_file(ACTIVITY_DOMAIN_ROCTX);
-        ss << std::dec << record->begin_ns << " " << record->process_id << ":" << record->thread_id
-           << " " << record->op << ":" << data->args.id << ":\""
-           << (data->args.message ? data->args.message : "") << "\""
-           << "\n";
-        *output_file << ss.str();
-        break;
-      }
-      case ACTIVITY_DOMAIN_HSA_API: {
-        const hsa_api_data_t* data = reinterpret_cast<const hsa_api_data_t*>(callback_data);
-        output_file = get_output_file(ACTIVITY_DOMAIN_HSA_API);
-        ss << std::dec << record->begin_ns << ":"
-           << ((record->op == HSA_API_ID_hsa_shut_down) ? record->begin_ns : record->end_ns) << " "
-           << record->process_id << ":" << record->thread_id << " "
-           << hsa_api_data_pair_t(record->op, *data) << " :" << std::dec << data->correlation_id
-           << "\n";
-        *output_file << ss.str();
-        break;
-      }
-      case ACTIVITY_DOMAIN_HIP_API: {
-        const hip_api_data_t* data = reinterpret_cast<const hip_api_data_t*>(callback_data);
-
-        std::string kernel_name;
-        if (record->kernel_name) {
-          static bool truncate = []() {
-            const char* env_var = getenv("ROCP_TRUNCATE_NAMES");
-            return env_var && std::atoi(env_var) != 0;
-          }();
-          kernel_name = cxx_demangle(record->kernel_name);
-          if (truncate) kernel_name = truncate_name(kernel_name);
-          kernel_name = " kernel=" + kernel_name;
-        }
+    output_file_t* output_file = format_callback_record(ss, record, callback_data);
+    if (output_file) *output_file << ss.str();
+    return (output_file && output_file->fail()) ? -1 : 0;
+  }
 
-        output_file = get_output_file(ACTIVITY_DOMAIN_HIP_API);
-        ss << std::dec << record->begin_ns << ":" << record->end_ns << " " << record->process_id
-           << ":" << record->thread_id << " " << hipApiString((hip_api_id_t)record->op, data)
-           << kernel_name << " :" << std::dec << data->correlation_id << "\n";
-        *output_file << ss.str();
-        break;
-      }
-      default:
-        warning("write_callback_record: ignored record for domain %d", record->domain);
-        break;
+  int write_callback_records(const roctracer_record_t* record, const void* callback_data,
+                             size_t count, size_t stride) {
+    std::stringstream ss;
+    output_file_t* output_file{nullptr};
+    uint32_t domain{0};
+
+    // The records are formatted into a single string, written with a single output operation
+    // each time the domain, and so the output file, changes.
+    auto write = [&]() {
+      if (output_file) *output_file << ss.str();
+      ss.str({});
+      return !(output_file && output_file->fail());
+    };
+
+    for (size_t i = 0; i < count; ++i) {
+      if (i != 0 && record->domain != domain && !write()) return -1;
+      domain = record->domain;
+      if (auto* file = format_callback_record(ss, record, callback_data)) output_file = file;
+
+      record = reinterpret_cast<const roctracer_record_t*>(
+          reinterpret_cast<const char*>(record) + stride);
+      callback_data = static_cast<const char*>(callback_data) + stride;
     }
-
-    return (output_file && output_file->fail()) ? -1 : 0;
+    return write() ? 0 : -1;
   }
 
   int write_activity_records(const roctracer_record_t* begin, const roctracer_record_t* end) {
@@ -324,6 +303,16 @@ class file_plugin_t {
           *output_file << ss.str();
           break;
         }
+        case ACTIVITY_DOMAIN_EXT_API:
+          if (begin->op == ACTIVITY_EXT_OP_RECORDS_LOST) {
+            warning("write_activity_records: %zu records lost for domain %u", begin->records_lost,
+                    begin->kind);
+          } else if (begin->op != ACTIVITY_EXT_OP_STRING_DEFINITION) {
+            // The string definitions are skipped, the kernel names are read from the interned
+            // strings the records point to.
+            warning("write_activity_records: ignored activity for domain %d", begin->domain);
+          }
+          break;
         case ACTIVITY_DOMAIN_HSA_OPS:
           output_file = get_output_file(ACTIVITY_DOMAIN_HSA_OPS, begin->op);
           if (begin->op == HSA_OP_ID_COPY) {
@@ -352,6 +341,58 @@ class file_plugin_t {
   bool is_valid() const { return valid_; }
 
  private:
+  // Format a callback record into 'ss', and return the file it should be written to, or nullptr if
+  // the record is ignored.
+  output_file_t* format_callback_record(std::ostream& ss, const roctracer_record_t* record,
+                                        const void* callback_data) {
+    output_file_t* output_file{nullptr};
+    switch (record->domain) {
+      case ACTIVITY_DOMAIN_ROCTX: {
+        const roctx_api_data_t* data = reinterpret_cast<const roctx_api_data_t*>(callback_data);
+        output_file = get_output_file(ACTIVITY_DOMAIN_ROCTX);
+        ss << std::dec << record->begin_ns << " " << record->process_id << ":" << record->thread_id
+           << " " << record->op << ":" << data->args.id << ":\""
+           << (data->args.message ? data->args.message : "") << "\""
+           << "\n";
+        break;
+      }
+      case ACTIVITY_DOMAIN_HSA_API: {
+        const hsa_api_data_t* data = reinterpret_cast<const hsa_api_data_t*>(callback_data);
+        output_file = get_output_file(ACTIVITY_DOMAIN_HSA_API);
+        ss << std::dec << record->begin_ns << ":"
+           << ((record->op == HSA_API_ID_hsa_shut_down) ? record->begin_ns : record->end_ns) << " "
+           << record->process_id << ":" << record->thread_id << " "
+           << hsa_api_data_pair_t(record->op, *data) << " :" << std::dec << data->correlation_id
+           << "\n";
+        break;
+      }
+      case ACTIVITY_DOMAIN_HIP_API: {
+        const hip_api_data_t* data = reinterpret_cast<const hip_api_data_t*>(callback_data);
+
+        std::string kernel_name;
+        if (record->kernel_name) {
+          static bool truncate = []() {
+            const char* env_var = getenv("ROCP_TRUNCATE_NAMES");
+            return env_var && std::atoi(env_var) != 0;
+          }();
+          kernel_name = cxx_demangle(record->kernel_name);
+          if (truncate) kernel_name = truncate_name(kernel_name);
+          kernel_name = " kernel=" + kernel_name;
+        }
+
+        output_file = get_output_file(ACTIVITY_DOMAIN_HIP_API);
+        ss << std::dec << record->begin_ns << ":" << record->end_ns << " " << record->process_id
+           << ":" << record->thread_id << " " << hipApiString((hip_api_id_t)record->op, data)
+           << kernel_name << " :" << std::dec << data->correlation_id << "\n";
+        break;
+      }
+      default:
+        warning("write_callback_record: ignored record for domain %d", record->domain);
+        break;
+    }
+    return output_file;
+  }
+
   bool valid_{false};
 
   output_file_t roctx_file_{"roctx_trace.txt"}, hsa_api_file_{"hsa_api_trace.txt"},
@@ -392,6 +433,13 @@ ROCTRACER_EXPORT int roctracer_plugin_write_callback_record(const roctracer_reco
   return file_plugin->write_callback_record(record, callback_data);
 }
 
+ROCTRACER_EXPORT int roctracer_plugin_write_callback_records(const roctracer_record_t* record,
+                                                             const void* callback_data,
+                                                             size_t count, size_t stride) {
+  if (!file_plugin || !file_plugin->is_valid()) return -1;
+  return file_plugin->write_callback_records(record, callback_data, count, stride);
+}
+
 ROCTRACER_EXPORT int roctracer_plugin_write_activity_records(const roctracer_record_t* begin,
                                                              const roctracer_record_t* end) {
   if (!file_plugin || !file_plugin->is_valid()) return -1;
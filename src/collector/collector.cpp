@@ -0,0 +1,173 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+// roctracer_collector: drains the shared memory segment of a memory pool created with
+// ROCTRACER_POOL_MODE_SHARED_MEMORY, and writes the records as text, one record per line:
+//
+//   <begin_ns>:<end_ns> <domain>:<op>:<kind> <correlation_id> <fields...>
+//
+// The collector runs until the traced process closes the pool or exits. With --drain, it only
+// drains the records left in the segment, for example after the traced process crashed.
+
+#include "roctracer.h"
+#include "roctracer_ext.h"
+#include "compact_record.h"
+#include "shared_memory_ring.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+#include <signal.h>
+
+using namespace roctracer;
+
+namespace {
+
+void usage(const char* program) {
+  std::cerr << "usage: " << program << " [-d|--drain] <segment> [output]" << std::endl;
+  exit(EXIT_FAILURE);
+}
+
+bool writer_exited(pid_t pid) { return kill(pid, 0) == -1 && errno == ESRCH; }
+
+class Collector {
+ public:
+  Collector(const SharedMemoryRing& ring, std::ostream& out) : ring_(ring), out_(out) {}
+
+  // Write the records of a chunk.
+  void WriteChunk(const std::byte* begin, const std::byte* end) {
+    const bool compact = (ring_.flags() & ROCTRACER_SHM_FLAG_COMPACT_RECORDS) != 0;
+
+    while (begin < end) {
+      roctracer_record_t record;
+      if (compact) {
+        begin = compact_record::Decode(begin, end, ring_.time_base_ns(), &record);
+        if (begin == nullptr) break;
+      } else {
+        if (static_cast<size_t>(end - begin) < sizeof(record)) break;
+        ::memcpy(&record, begin, sizeof(record));
+        begin += sizeof(record);
+      }
+
+      // The string of a definition follows the record, padded to a multiple of 8 bytes.
+      if (record.domain == ACTIVITY_DOMAIN_EXT_API &&
+          record.op == ACTIVITY_EXT_OP_STRING_DEFINITION) {
+        const char* string = reinterpret_cast<const char*>(begin);
+        const size_t length = strnlen(string, end - begin);
+        strings_[record.string_id].assign(string, length);
+        begin += (length + 8) & ~size_t{7};
+        continue;
+      }
+      WriteRecord(record);
+    }
+  }
+
+ private:
+  void WriteRecord(const roctracer_record_t& record) {
+    if (record.domain == ACTIVITY_DOMAIN_EXT_API && record.op == ACTIVITY_EXT_OP_RECORDS_LOST) {
+      std::cerr << "roctracer_collector: " << record.records_lost << " records lost for domain "
+                << record.kind << std::endl;
+      return;
+    }
+
+    out_ << record.begin_ns << ':' << record.end_ns << ' ' << record.domain << ':' << record.op
+         << ':' << record.kind << ' ' << record.correlation_id;
+    switch (compact_record::DomainLayout(record.domain)) {
+      case compact_record::Layout::kOps:
+        out_ << ' ' << record.device_id << ':' << record.queue_id;
+        if (record.string_id != 0) {
+          auto it = strings_.find(record.string_id);
+          out_ << ' ' << (it != strings_.end() ? it->second : std::to_string(record.string_id));
+        } else {
+          out_ << ' ' << record.bytes;
+        }
+        break;
+      case compact_record::Layout::kApi:
+        out_ << ' ' << record.process_id << ':' << record.thread_id;
+        break;
+      case compact_record::Layout::kOther:
+        out_ << ' ' << record.external_id;
+        break;
+    }
+    out_ << '\n';
+  }
+
+  const SharedMemoryRing& ring_;
+  std::ostream& out_;
+  std::unordered_map<uint32_t, std::string> strings_;  // The defined strings, by string ID.
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool drain = false;
+  int arg = 1;
+  if (arg < argc && (strcmp(argv[arg], "-d") == 0 || strcmp(argv[arg], "--drain") == 0)) {
+    drain = true;
+    ++arg;
+  }
+  if (arg >= argc || argc - arg > 2) usage(argv[0]);
+  const char* segment = argv[arg++];
+
+  std::ofstream output_file;
+  if (arg < argc) {
+    output_file.open(argv[arg]);
+    if (!output_file) {
+      std::cerr << "roctracer_collector: cannot open " << argv[arg] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::ostream& out = output_file.is_open() ? output_file : std::cout;
+
+  try {
+    SharedMemoryRing ring(segment);
+    Collector collector(ring, out);
+    auto write_chunk = [&collector](const std::byte* begin, const std::byte* end) {
+      collector.WriteChunk(begin, end);
+    };
+
+    while (true) {
+      // Check whether the writer is done before draining, so that its last chunks are drained.
+      const bool done = drain || ring.closed() || writer_exited(ring.writer_pid());
+      if (ring.Consume(write_chunk) == 0) {
+        if (done) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+
+    if (ring.records_lost() != 0)
+      std::cerr << "roctracer_collector: " << ring.records_lost()
+                << " records lost, the segment was full" << std::endl;
+  } catch (const std::system_error& e) {
+    std::cerr << "roctracer_collector: " << segment << ": " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  out.flush();
+  return out.fail() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -70,4 +70,47 @@ ROCTRACER_API roctracer_status_t roctracer_disable_activity() {
   return ROCTRACER_STATUS_SUCCESS;
 }
 
+// Versions of roctracer_open_pool and roctracer_open_pool_expl for the applications built before
+// the fields following buffer_callback_arg were added to roctracer_properties_t. These callers pass
+// the smaller structure, so only its fields are read and the new fields are set to 0.
+namespace {
+
+struct roctracer_properties_4_1_t {
+  uint32_t mode;
+  size_t buffer_size;
+  roctracer_allocator_t alloc_fun;
+  void* alloc_arg;
+  roctracer_buffer_callback_t buffer_callback_fun;
+  void* buffer_callback_arg;
+};
+
+roctracer_properties_t ConvertProperties(const roctracer_properties_4_1_t& properties) {
+  roctracer_properties_t converted{};
+  converted.mode = properties.mode;
+  converted.buffer_size = properties.buffer_size;
+  converted.alloc_fun = properties.alloc_fun;
+  converted.alloc_arg = properties.alloc_arg;
+  converted.buffer_callback_fun = properties.buffer_callback_fun;
+  converted.buffer_callback_arg = properties.buffer_callback_arg;
+  return converted;
+}
+
+}  // namespace
+
+ROCTRACER_API roctracer_status_t roctracer_open_pool_expl_4_0(
+    const roctracer_properties_4_1_t* properties, roctracer_pool_t** pool) {
+  if (properties == nullptr) return roctracer_open_pool_expl(nullptr, pool);
+  roctracer_properties_t converted = ConvertProperties(*properties);
+  return roctracer_open_pool_expl(&converted, pool);
+}
+__asm__(".symver roctracer_open_pool_expl_4_0,roctracer_open_pool_expl@ROCTRACER_4.0");
+
+ROCTRACER_API roctracer_status_t
+roctracer_open_pool_4_1(const roctracer_properties_4_1_t* properties) {
+  if (properties == nullptr) return roctracer_open_pool(nullptr);
+  roctracer_properties_t converted = ConvertProperties(*properties);
+  return roctracer_open_pool(&converted);
+}
+__asm__(".symver roctracer_open_pool_4_1,roctracer_open_pool@ROCTRACER_4.1");
+
 }  // extern "C"
@@ -0,0 +1,229 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+#ifndef COMPACT_RECORD_H_
+#define COMPACT_RECORD_H_
+
+#include "roctracer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// The compact record encoding stores an activity record in a variable number of bytes, using the
+// domain to select the fields to encode:
+//
+//   domain       varint
+//   kind         varint
+//   op           16 bits, little endian, or 0xffff followed by a varint for larger op IDs
+//   correlation  varint
+//   begin_ns     zigzag varint of the difference with the pool's time base
+//   end_ns       zigzag varint of the difference with begin_ns
+//   HSA_OPS, HIP_OPS:  device_id (zigzag varint), string_id (varint), queue_id (varint)
+//   API domains:       process_id (varint), thread_id (varint)
+//   other domains:     the two 64-bit words of the union (varints)
+//   bytes/kernel_name  varint of the 64-bit word
+//
+// The fields not used by the domain, for example the queue ID of an API record, are not preserved.
+// The differences are computed modulo 2^64, so any timestamp values round trip.
+namespace roctracer::compact_record {
+
+// The largest size of an encoded record.
+constexpr size_t kMaxRecordSize = 80;
+
+inline std::byte* EncodeVarint(std::byte* out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = std::byte(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = std::byte(value);
+  return out;
+}
+
+// Return the byte after the varint, or nullptr if it is truncated or too long.
+inline const std::byte* DecodeVarint(const std::byte* in, const std::byte* end, uint64_t* value) {
+  uint64_t result = 0;
+  for (unsigned shift = 0; in < end && shift < 64; shift += 7) {
+    const auto byte = static_cast<uint64_t>(*in++);
+    result |= (byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return in;
+    }
+  }
+  return nullptr;
+}
+
+inline uint64_t ZigZag(uint64_t value) {
+  return (value << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(value) >> 63);
+}
+inline uint64_t UnZigZag(uint64_t value) { return (value >> 1) ^ (~(value & 1) + 1); }
+
+enum class Layout { kOps, kApi, kOther };
+
+inline Layout DomainLayout(uint32_t domain) {
+  switch (domain) {
+    case ACTIVITY_DOMAIN_HSA_OPS:
+    case ACTIVITY_DOMAIN_HIP_OPS:
+      return Layout::kOps;
+    case ACTIVITY_DOMAIN_HSA_API:
+    case ACTIVITY_DOMAIN_HIP_API:
+    case ACTIVITY_DOMAIN_KFD_API:
+    case ACTIVITY_DOMAIN_ROCTX:
+      return Layout::kApi;
+    default:
+      return Layout::kOther;
+  }
+}
+
+// The 64-bit words of the record unions, read and written with memcpy as the unions may hold any
+// of their members.
+constexpr size_t kUnionOffset = offsetof(roctracer_record_t, device_id);
+constexpr size_t kPayloadOffset = offsetof(roctracer_record_t, bytes);
+static_assert(kPayloadOffset == kUnionOffset + 2 * sizeof(uint64_t));
+
+inline uint64_t LoadWord(const roctracer_record_t& record, size_t offset) {
+  uint64_t word;
+  ::memcpy(&word, reinterpret_cast<const std::byte*>(&record) + offset, sizeof(word));
+  return word;
+}
+inline void StoreWord(roctracer_record_t* record, size_t offset, uint64_t word) {
+  ::memcpy(reinterpret_cast<std::byte*>(record) + offset, &word, sizeof(word));
+}
+
+// Encode 'record' at 'out', which must have room for kMaxRecordSize bytes. Return the end of the
+// encoded record.
+inline std::byte* Encode(const roctracer_record_t& record, uint64_t time_base_ns, std::byte* out) {
+  out = EncodeVarint(out, record.domain);
+  out = EncodeVarint(out, record.kind);
+  const auto op = static_cast<uint16_t>(record.op < 0xffff ? record.op : 0xffff);
+  *out++ = std::byte(op);
+  *out++ = std::byte(op >> 8);
+  if (op == 0xffff) out = EncodeVarint(out, record.op);
+
+  out = EncodeVarint(out, record.correlation_id);
+  out = EncodeVarint(out, ZigZag(record.begin_ns - time_base_ns));
+  out = EncodeVarint(out, ZigZag(record.end_ns - record.begin_ns));
+
+  switch (DomainLayout(record.domain)) {
+    case Layout::kOps:
+      out = EncodeVarint(out, ZigZag(static_cast<int64_t>(record.device_id)));
+      out = EncodeVarint(out, record.string_id);
+      out = EncodeVarint(out, record.queue_id);
+      break;
+    case Layout::kApi:
+      out = EncodeVarint(out, record.process_id);
+      out = EncodeVarint(out, record.thread_id);
+      break;
+    case Layout::kOther:
+      out = EncodeVarint(out, LoadWord(record, kUnionOffset));
+      out = EncodeVarint(out, LoadWord(record, kUnionOffset + sizeof(uint64_t)));
+      break;
+  }
+  return EncodeVarint(out, LoadWord(record, kPayloadOffset));
+}
+
+// Decode the record at 'in' into 'record'. Return the end of the encoded record, or nullptr if the
+// record is truncated or malformed.
+inline const std::byte* Decode(const std::byte* in, const std::byte* end, uint64_t time_base_ns,
+                               roctracer_record_t* record) {
+  *record = {};
+  uint64_t value, value2;
+
+  if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+  record->domain = static_cast<uint32_t>(value);
+  if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+  record->kind = static_cast<activity_kind_t>(value);
+  if (end - in < 2) return nullptr;
+  record->op = static_cast<uint32_t>(in[0]) | static_cast<uint32_t>(in[1]) << 8;
+  in += 2;
+  if (record->op == 0xffff) {
+    if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+    record->op = static_cast<activity_op_t>(value);
+  }
+
+  if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+  record->correlation_id = value;
+  if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+  record->begin_ns = time_base_ns + UnZigZag(value);
+  if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+  record->end_ns = record->begin_ns + UnZigZag(value);
+
+  switch (DomainLayout(record->domain)) {
+    case Layout::kOps:
+      if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+      record->device_id = static_cast<int>(UnZigZag(value));
+      if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+      record->string_id = static_cast<uint32_t>(value);
+      if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+      record->queue_id = value;
+      break;
+    case Layout::kApi:
+      if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+      if ((in = DecodeVarint(in, end, &value2)) == nullptr) return nullptr;
+      record->process_id = static_cast<uint32_t>(value);
+      record->thread_id = static_cast<uint32_t>(value2);
+      break;
+    case Layout::kOther:
+      if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+      if ((in = DecodeVarint(in, end, &value2)) == nullptr) return nullptr;
+      StoreWord(record, kUnionOffset, value);
+      StoreWord(record, kUnionOffset + sizeof(uint64_t), value2);
+      break;
+  }
+
+  if ((in = DecodeVarint(in, end, &value)) == nullptr) return nullptr;
+  StoreWord(record, kPayloadOffset, value);
+  return in;
+}
+
+// Iterates over the records of a buffer of compact records, decoding them into standard activity
+// records:
+//
+//   for (Iterator it(begin, end, time_base_ns); it.Next();) Process(*it);
+//
+class Iterator {
+ public:
+  Iterator(const void* begin, const void* end, uint64_t time_base_ns)
+      : ptr_(static_cast<const std::byte*>(begin)),
+        end_(static_cast<const std::byte*>(end)),
+        time_base_ns_(time_base_ns) {}
+
+  // Decode the next record. Return false if there are no more records, or if the next record is
+  // malformed.
+  bool Next() {
+    if (ptr_ == nullptr || ptr_ >= end_) return false;
+    ptr_ = Decode(ptr_, end_, time_base_ns_, &record_);
+    return ptr_ != nullptr;
+  }
+
+  const roctracer_record_t& operator*() const { return record_; }
+  const roctracer_record_t* operator->() const { return &record_; }
+
+ private:
+  const std::byte* ptr_;
+  const std::byte* const end_;
+  const uint64_t time_base_ns_;
+  roctracer_record_t record_{};
+};
+
+}  // namespace roctracer::compact_record
+
+#endif  // COMPACT_RECORD_H_
@@ -0,0 +1,291 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+#ifndef CONSUMER_EXECUTOR_H_
+#define CONSUMER_EXECUTOR_H_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace roctracer {
+
+// A unit of work scheduled on the consumer executor, for example a memory pool with buffers to
+// process. A task is never run by more than one worker thread at a time, so the work of a task is
+// processed in order.
+class ConsumerTask {
+ public:
+  virtual ~ConsumerTask() = default;
+
+ protected:
+  friend class ConsumerExecutor;
+
+  // Process some of the pending work. Return true if there is more work to process, in which case
+  // the task is scheduled again after the other ready tasks.
+  virtual bool Run() = 0;
+
+  // Called before Run() when the task's period elapsed, see ConsumerExecutor::SetPeriod.
+  virtual void Tick() {}
+
+ private:
+  // Guarded by the executor's mutex.
+  bool scheduled_{false};  // The task is in the ready queue, or must be requeued once run.
+  bool running_{false};    // A worker thread is running the task.
+  bool tick_pending_{false};
+  std::chrono::steady_clock::duration period_{};
+  std::chrono::steady_clock::time_point next_tick_;
+};
+
+// A process-wide pool of worker threads running the consumer tasks of all the memory pools, and
+// their periodic timers.
+//
+// By default, the worker threads are started as tasks are added, up to one per task and a quarter
+// of the CPUs, so that many memory pools do not add as many threads. A fixed number of worker
+// threads can be configured instead, or one worker thread per task, so that a task blocked in
+// Run(), for example by a slow buffer callback, never delays the other tasks.
+//
+// The worker threads are stopped and joined when the last task is removed, and when the executor
+// is shut down as the library is unloaded, so that no thread is left running the library's code.
+class ConsumerExecutor {
+ public:
+  // The executor is never destroyed, as memory pools may be destroyed while the static objects
+  // are being destroyed.
+  static ConsumerExecutor& Instance() {
+    static auto* instance = new ConsumerExecutor();
+    return *instance;
+  }
+
+  // The thread count configuring one worker thread per task.
+  static constexpr size_t kThreadPerTask = ~size_t{0};
+
+  // Set the number of worker threads, 0 for the default, or kThreadPerTask, and the CPUs they may
+  // run on (any CPU if 'cpus' is empty). Return false if the worker threads are already started.
+  bool Configure(size_t thread_count, std::vector<uint32_t> cpus) {
+    std::lock_guard lock(mutex_);
+    if (!workers_.empty()) return false;
+    thread_count_ = thread_count;
+    cpus_ = std::move(cpus);
+    return true;
+  }
+
+  // Add the task to the executor. A task must be added before it is scheduled, and removed before
+  // it is destroyed.
+  void Add(ConsumerTask&) {
+    std::lock_guard lock(mutex_);
+    ++task_count_;
+    // Once started, the worker threads are added as tasks are added, see StartWorkers().
+    if (!workers_.empty() && !shutdown_) StartWorkers();
+  }
+
+  // Schedule the task to be run by a worker thread, unless it is already scheduled. Once the
+  // executor is shut down, the task is run by the calling thread instead.
+  void Schedule(ConsumerTask& task) {
+    std::unique_lock lock(mutex_);
+    if (task.scheduled_) return;
+    task.scheduled_ = true;
+
+    // A running task is requeued by its worker thread once run.
+    if (task.running_) return;
+    if (shutdown_) return RunInline(lock, task);
+
+    ready_.push_back(&task);
+    if (workers_.empty()) StartWorkers();
+    cond_.notify_one();
+  }
+
+  // Run the task's Tick() every 'period', or stop if 'period' is zero. The ticks are skipped,
+  // not accumulated, if the workers are late.
+  void SetPeriod(ConsumerTask& task, std::chrono::steady_clock::duration period) {
+    std::lock_guard lock(mutex_);
+    auto it = std::find(periodic_.begin(), periodic_.end(), &task);
+    if (it != periodic_.end()) periodic_.erase(it);
+
+    task.period_ = period;
+    if (period == period.zero()) return;
+    task.next_tick_ = std::chrono::steady_clock::now() + period;
+    periodic_.push_back(&task);
+
+    if (workers_.empty() && !shutdown_) StartWorkers();
+    // Wake up a worker thread so that it waits for the new timer.
+    cond_.notify_one();
+  }
+
+  // Remove the task from the executor, once the work scheduled for it is run. Once this returns,
+  // the executor does not reference the task anymore. If this was the last task, the worker
+  // threads are stopped.
+  void Remove(ConsumerTask& task) {
+    std::unique_lock lock(mutex_);
+    if (auto it = std::find(periodic_.begin(), periodic_.end(), &task); it != periodic_.end())
+      periodic_.erase(it);
+
+    idle_cond_.wait(lock, [&task]() { return !task.running_ && !task.scheduled_; });
+    if (--task_count_ == 0) StopWorkers(lock);
+  }
+
+  // Run the work scheduled for all the tasks, then stop the worker threads. The work scheduled
+  // afterwards is run by the thread scheduling it, and the periodic timers are stopped. Called
+  // when the library is unloaded.
+  void Shutdown() {
+    std::unique_lock lock(mutex_);
+    shutdown_ = true;
+    periodic_.clear();
+    idle_cond_.wait(lock, [this]() { return ready_.empty() && running_count_ == 0; });
+    StopWorkers(lock);
+  }
+
+ private:
+  ConsumerExecutor() = default;
+
+  // Start the worker threads missing from the configured number, or from one per task up to
+  // a quarter of the CPUs by default. Must be called with the mutex held.
+  void StartWorkers() {
+    size_t thread_count = thread_count_;
+    if (thread_count == kThreadPerTask)
+      thread_count = task_count_;
+    else if (thread_count == 0)
+      thread_count = std::min<size_t>(task_count_, std::thread::hardware_concurrency() / 4);
+    thread_count = std::max<size_t>(1, thread_count);
+    while (workers_.size() < thread_count) StartWorker();
+  }
+
+  // Must be called with the mutex held.
+  void StartWorker() {
+    workers_.emplace_back(&ConsumerExecutor::WorkerLoop, this, generation_);
+
+    // Failing to set the affinity, for example if none of the CPUs is available to the process,
+    // is not fatal.
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (uint32_t cpu : cpus_)
+      if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpu_set);
+    if (CPU_COUNT(&cpu_set) != 0)
+      pthread_setaffinity_np(workers_.back().native_handle(), sizeof(cpu_set), &cpu_set);
+  }
+
+  // Stop the worker threads and wait for them to exit. The worker threads are started again if a
+  // task is scheduled later. Must be called with the mutex held, which is released while waiting.
+  void StopWorkers(std::unique_lock<std::mutex>& lock) {
+    std::vector<std::thread> workers = std::move(workers_);
+    workers_.clear();
+    ++generation_;
+    cond_.notify_all();
+
+    lock.unlock();
+    for (auto&& worker : workers) worker.join();
+    lock.lock();
+  }
+
+  // Run the task in the calling thread until no more work is scheduled for it. Must be called
+  // with the mutex held.
+  void RunInline(std::unique_lock<std::mutex>& lock, ConsumerTask& task) {
+    while (std::exchange(task.scheduled_, false)) {
+      task.running_ = true;
+      lock.unlock();
+      const bool more_work = task.Run();
+      lock.lock();
+      task.running_ = false;
+      if (more_work) task.scheduled_ = true;
+    }
+    idle_cond_.notify_all();
+  }
+
+  // Schedule the tasks with an elapsed period, and return the time of the next tick, or
+  // time_point::max() if there are no periodic tasks. Must be called with the mutex held.
+  std::chrono::steady_clock::time_point FireTimers() {
+    const auto now = std::chrono::steady_clock::now();
+    auto next_tick = std::chrono::steady_clock::time_point::max();
+
+    for (ConsumerTask* task : periodic_) {
+      if (task->next_tick_ <= now) {
+        task->tick_pending_ = true;
+        task->next_tick_ = now + task->period_;
+        if (!task->scheduled_) {
+          task->scheduled_ = true;
+          if (!task->running_) ready_.push_back(task);
+        }
+      }
+      next_tick = std::min(next_tick, task->next_tick_);
+    }
+    return next_tick;
+  }
+
+  // The loop of a worker thread started for the given generation of worker threads. The thread
+  // exits when the worker threads of its generation are stopped.
+  void WorkerLoop(uint64_t generation) {
+    std::unique_lock lock(mutex_);
+    while (generation == generation_) {
+      const auto next_tick = FireTimers();
+      if (ready_.empty()) {
+        if (next_tick == std::chrono::steady_clock::time_point::max())
+          cond_.wait(lock);
+        else
+          cond_.wait_until(lock, next_tick);
+        continue;
+      }
+
+      ConsumerTask* task = ready_.front();
+      ready_.pop_front();
+      task->scheduled_ = false;
+      task->running_ = true;
+      ++running_count_;
+      const bool tick = std::exchange(task->tick_pending_, false);
+
+      lock.unlock();
+      if (tick) task->Tick();
+      bool more_work = task->Run();
+      lock.lock();
+
+      task->running_ = false;
+      --running_count_;
+      if (more_work) task->scheduled_ = true;
+      if (task->scheduled_) {
+        ready_.push_back(task);
+        cond_.notify_one();
+      }
+      idle_cond_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cond_;       // Signaled when a task is ready.
+  std::condition_variable idle_cond_;  // Signaled when a task is done running.
+  std::deque<ConsumerTask*> ready_;
+  std::vector<ConsumerTask*> periodic_;
+  std::vector<std::thread> workers_;
+  uint64_t generation_{0};  // Incremented when the worker threads are stopped.
+  size_t running_count_{0};  // The number of tasks being run by the worker threads.
+  size_t task_count_{0};
+  bool shutdown_{false};
+  size_t thread_count_{0};  // 0 for the default, or kThreadPerTask.
+  std::vector<uint32_t> cpus_;
+};
+
+}  // namespace roctracer
+
+#endif  // CONSUMER_EXECUTOR_H_
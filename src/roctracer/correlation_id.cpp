@@ -22,56 +22,109 @@
 #include "roctracer.h"
 
 #include <atomic>
-#include <stack>
+#include <cassert>
+#include <type_traits>
 #include <vector>
 
 namespace {
 
+void RegisterSpillRelease();
+
 // A stack that can be used for TLS variables. TLS destructors are invoked before global destructors
-// which is a problem if operations invoked by global destructors use TLS variables. If the TLS
-// stack is destructed, it still has well defined behavior by always returning a dummy element.
-template <typename T> class Stack : std::stack<T, std::vector<T>> {
-  using parent_type = typename std::stack<T, std::vector<T>>;
+// which is a problem if operations invoked by global destructors use TLS variables. The first
+// 'InlineCapacity' elements are stored inline, and the stack is constant-initialized and trivially
+// destructible: its TLS variables need neither an initialization check nor a destructor, and remain
+// usable after the TLS destructors ran. The deeper elements spill to a heap allocated vector, which
+// is released when the thread exits. Once released, the stack still counts the deeper elements but
+// does not store them, and returns a dummy element for them.
+template <typename T, size_t InlineCapacity = 16> class Stack {
+  static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
 
  public:
-  Stack() { valid_.store(true, std::memory_order_relaxed); }
-  ~Stack() { valid_.store(false, std::memory_order_relaxed); }
+  constexpr Stack() = default;
 
-  template <class... Args> auto& emplace(Args&&... args) {
-    return is_valid() ? parent_type::emplace(std::forward<Args>(args)...)
-                      : dummy_element_ = T(std::forward<Args>(args)...);
-  }
-  void push(const T& v) {
-    if (is_valid()) parent_type::push(v);
-  }
-  void push(T&& v) {
-    if (is_valid()) parent_type::push(std::move(v));
+  T& push(T value) {
+    if (size_ < InlineCapacity) return elements_[size_++] = value;
+    ++size_;
+    if (std::vector<T>* spill = GetSpill(); spill != nullptr) return spill->emplace_back(value);
+    return dummy_element_ = value;
   }
   void pop() {
-    if (is_valid()) parent_type::pop();
+    if (size_ == 0) return;
+    if (size_-- > InlineCapacity && spill_ != nullptr) spill_->pop_back();
   }
-  const auto& top() const { return is_valid() ? parent_type::top() : dummy_element_; }
-  auto& top() { return is_valid() ? parent_type::top() : (dummy_element_ = {}); }
+  T& top() {
+    assert(size_ != 0 && "the stack is empty");
+    if (size_ <= InlineCapacity) return elements_[size_ - 1];
+    return spill_ != nullptr ? spill_->back() : dummy_element_;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
 
-  bool is_valid() const { return valid_.load(std::memory_order_relaxed); }
-  size_t size() const { return is_valid() ? parent_type::size() : 0; }
-  bool empty() const { return size() == 0; }
+  // Free the spilled elements. The stack does not spill anymore after this call.
+  void ReleaseSpill() {
+    delete spill_;
+    spill_ = nullptr;
+    spill_released_ = true;
+  }
 
  private:
-  std::atomic<bool> valid_{false};
-  T dummy_element_;  // Dummy element used when the stack is not valid.
+  std::vector<T>* GetSpill() {
+    if (spill_ == nullptr && !spill_released_) {
+      spill_ = new std::vector<T>();
+      RegisterSpillRelease();
+    }
+    return spill_;
+  }
+
+  T elements_[InlineCapacity]{};
+  size_t size_{0};
+  std::vector<T>* spill_{nullptr};
+  bool spill_released_{false};
+  T dummy_element_{};  // Dummy element used for the deeper elements once the spill is released.
 };
 
 thread_local Stack<activity_correlation_id_t> correlation_id_stack{};
 thread_local Stack<activity_correlation_id_t> external_id_stack{};
 
+// Release the spilled elements of the thread's stacks when the thread exits. Only the threads whose
+// stacks spilled construct the guard, and so register a TLS destructor.
+void RegisterSpillRelease() {
+  struct SpillGuard {
+    ~SpillGuard() {
+      correlation_id_stack.ReleaseSpill();
+      external_id_stack.ReleaseSpill();
+    }
+  };
+  static thread_local SpillGuard guard;
+}
+
+// The correlation IDs are taken from the global counter in blocks of kCorrelationIdBlockSize IDs,
+// and handed out by each thread from its current block, so that the counter's cache line is only
+// written once every kCorrelationIdBlockSize API calls of a thread. The IDs are unique and
+// non-zero, but are not ordered across threads. The block bounds are trivially destructible, so
+// they remain usable during the TLS destruction.
+constexpr uint64_t kCorrelationIdBlockSize = 4096;
+std::atomic<uint64_t> correlation_id_counter{1};
+thread_local uint64_t next_correlation_id{0};
+thread_local uint64_t correlation_id_block_end{0};
+
+activity_correlation_id_t NextCorrelationId() {
+  if (next_correlation_id == correlation_id_block_end) {
+    next_correlation_id =
+        correlation_id_counter.fetch_add(kCorrelationIdBlockSize, std::memory_order_relaxed);
+    correlation_id_block_end = next_correlation_id + kCorrelationIdBlockSize;
+  }
+  return next_correlation_id++;
+}
+
 }  // namespace
 
 namespace roctracer {
 
 activity_correlation_id_t CorrelationIdPush() {
-  static std::atomic<uint64_t> counter{1};
-  return correlation_id_stack.emplace(counter.fetch_add(1, std::memory_order_relaxed));
+  return correlation_id_stack.push(NextCorrelationId());
 }
 
 void CorrelationIdPop() { correlation_id_stack.pop(); }
@@ -96,4 +149,26 @@ std::optional<activity_correlation_id_t> ExternalCorrelationId() {
   return external_id_stack.empty() ? std::nullopt : std::make_optional(external_id_stack.top());
 }
 
+CorrelationContext CorrelationContextCapture() {
+  return {CorrelationId(), ExternalCorrelationId()};
+}
+
+void CorrelationContextRestore(const CorrelationContext& context) {
+  correlation_id_stack.push(context.correlation_id);
+  if (context.external_id) external_id_stack.push(*context.external_id);
+}
+
+bool CorrelationContextRelease(const CorrelationContext& context) {
+  // Only pop if the top of the stacks are the IDs pushed by restoring the context.
+  if (correlation_id_stack.empty() || correlation_id_stack.top() != context.correlation_id)
+    return false;
+  if (context.external_id &&
+      (external_id_stack.empty() || external_id_stack.top() != *context.external_id))
+    return false;
+
+  correlation_id_stack.pop();
+  if (context.external_id) external_id_stack.pop();
+  return true;
+}
+
 }  // namespace roctracer
\ No newline at end of file
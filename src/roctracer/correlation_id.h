@@ -47,4 +47,22 @@ std::optional<activity_correlation_id_t> ExternalCorrelationIdPop();
 // Return the current external correlation ID or nullopt is no region is active.
 std::optional<activity_correlation_id_t> ExternalCorrelationId();
 
+// The current correlation ID and external correlation ID of a thread.
+struct CorrelationContext {
+  activity_correlation_id_t correlation_id;
+  std::optional<activity_correlation_id_t> external_id;
+};
+
+// Return the calling thread's correlation context.
+CorrelationContext CorrelationContextCapture();
+
+// Push the correlation ID and the external correlation ID, if any, of the \p context onto the
+// calling thread's stacks, so that the thread continues the regions of the thread that captured the
+// context.
+void CorrelationContextRestore(const CorrelationContext& context);
+
+// Pop the regions pushed by CorrelationContextRestore(\p context). Return false, leaving the stacks
+// unchanged, if the top of the stacks are not the IDs of \p context.
+bool CorrelationContextRelease(const CorrelationContext& context);
+
 }  // namespace roctracer
\ No newline at end of file
@@ -22,54 +22,114 @@
 #define MEMORY_POOL_H_
 
 #include "roctracer.h"
+#include "roctracer_ext.h"
+#include "compact_record.h"
+#include "consumer_executor.h"
+#include "page_allocator.h"
+#include "shared_memory_ring.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
 #include <cstdlib>
 #include <cstddef>
 #include <cstring>
-#include <future>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace roctracer {
 
-class MemoryPool {
+class MemoryPool : private ConsumerTask {
  public:
-  MemoryPool(const roctracer_properties_t& properties) : properties_(properties) {
-    // Pool definition: The memory pool is split in 2 buffers of equal size. When first initialized,
-    // the write pointer points to the first element of the first buffer. When a buffer is full,  or
-    // when Flush() is called, the write pointer moves to the other buffer.
+  MemoryPool(const roctracer_properties_t& properties)
+      : properties_(properties),
+        per_thread_buffers_((properties.mode & ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS) != 0),
+        compact_records_((properties.mode & ROCTRACER_POOL_MODE_COMPACT_RECORDS) != 0),
+        time_base_ns_(properties.time_base_ns),
+        buffer_size_(std::max(2 * RecordSize<roctracer_record_t>(), properties.buffer_size)),
+        buffer_count_(std::max<size_t>(2, properties.buffer_count)),
+        overflow_policy_(properties.overflow_policy) {
+    // In shared memory mode, the consumer thread publishes the records to a ring in a shared
+    // memory segment instead of calling the buffer callback. The ring holds at least 2 buffers.
+    if ((properties.mode & ROCTRACER_POOL_MODE_SHARED_MEMORY) != 0) {
+      size_t ring_size = 1;
+      while (ring_size < std::max(properties.shared_memory_size,
+                                  2 * (buffer_size_ + SharedMemoryRing::kChunkHeaderSize)))
+        ring_size <<= 1;
+      shared_ring_ = std::make_unique<SharedMemoryRing>(
+          properties.shared_memory_path, ring_size,
+          compact_records_ ? ROCTRACER_SHM_FLAG_COMPACT_RECORDS : 0, time_base_ns_);
+    }
+
+    // Use the page allocator if a page allocation mode is requested and no custom allocator is
+    // provided.
+    if (properties.alloc_fun == nullptr &&
+        (properties.mode & (ROCTRACER_POOL_MODE_HUGE_PAGES | ROCTRACER_POOL_MODE_NUMA_BIND)) != 0) {
+      int numa_node = PageAllocator::kNoNumaNode;
+      if ((properties.mode & ROCTRACER_POOL_MODE_NUMA_BIND) != 0)
+        numa_node = properties.numa_node >= 0 ? properties.numa_node
+                                              : PageAllocator::CurrentNumaNode();
+      page_allocator_.emplace((properties.mode & ROCTRACER_POOL_MODE_HUGE_PAGES) != 0, numa_node);
+    }
+
+    // Pool definition: The memory pool is split in 'buffer_count_' buffers of equal size. When
+    // first initialized, the write pointer points to the first element of the first buffer, and
+    // the other buffers are free. When a buffer is full, or when Flush() is called, the buffer is
+    // queued for the consumer thread and the write pointer moves to a free buffer. When all the
+    // buffers are queued, producers wait for the consumer thread or drop records depending on the
+    // overflow policy.
     // Each buffer should be large enough to hold at least 2 activity records, as record pairs may
     // be written when external correlation ids are used.
-    const size_t allocation_size =
-        2 * std::max(2 * sizeof(roctracer_record_t), properties_.buffer_size);
+    const size_t allocation_size = buffer_count_ * buffer_size_;
     pool_begin_ = nullptr;
     AllocateMemory(&pool_begin_, allocation_size);
     assert(pool_begin_ != nullptr && "pool allocator failed");
 
-    pool_end_ = pool_begin_ + allocation_size;
-    buffer_begin_ = pool_begin_;
-    buffer_end_ = buffer_begin_ + properties_.buffer_size;
-    record_ptr_ = buffer_begin_;
-    data_ptr_ = buffer_end_;
+    for (size_t i = buffer_count_ - 1; i > 0; --i)
+      free_buffers_.push_back(pool_begin_ + i * buffer_size_);
+    SetBuffer(pool_begin_);
 
-    // Create a consumer thread and wait for it to be ready to accept work.
-    std::promise<void> ready;
-    std::future<void> future = ready.get_future();
-    consumer_thread_ = std::thread(&MemoryPool::ConsumerThreadLoop, this, std::move(ready));
-    future.wait();
+    ConsumerExecutor::Instance().Add(*this);
+
+    // Let the consumer executor flush the pool periodically if requested.
+    if (properties.flush_interval_ns != 0)
+      ConsumerExecutor::Instance().SetPeriod(
+          *this, std::chrono::nanoseconds(properties.flush_interval_ns));
   }
 
   ~MemoryPool() {
     Flush();
 
-    // Wait for the previous flush to complete, then send the exit signal.
-    NotifyConsumerThread(nullptr, nullptr);
-    consumer_thread_.join();
+    // Wait for all the pending operations, including the asynchronous flushes completions, then
+    // remove the pool from the consumer executor.
+    {
+      std::unique_lock consumer_lock(consumer_mutex_);
+      consumer_cond_.wait(consumer_lock, [this]() { return completed_ticket_ == queued_ticket_; });
+    }
+    ConsumerExecutor::Instance().Remove(*this);
+    if (shared_ring_) shared_ring_->Close();
+
+    // Detach the lanes from the pool. The lanes may still be referenced by their owner thread's
+    // lane list, but they will not be used again.
+    for (auto&& lane : lanes_) lane->closed.store(true, std::memory_order_relaxed);
+    for (auto* buffer : lane_buffers_) FreeMemory(buffer, buffer_size_);
 
-    // Free the pool's buffer memory.
-    AllocateMemory(&pool_begin_, 0);
+    // Free the pool's buffer memory, and the spilled data of the records left in the buffers.
+    FreeMemory(pool_begin_, buffer_count_ * buffer_size_);
+    for (auto&& [buffer, spills] : buffer_spills_)
+      for (auto&& spill : spills) free(spill.data);
+    for (auto&& spill : free_spills_) free(spill.data);
   }
 
   MemoryPool(const MemoryPool&) = delete;
@@ -79,119 +139,1036 @@ class MemoryPool {
   void Write(Record&& record, const void* data, size_t data_size, Functor&& store_data = {}) {
     assert(data != nullptr || data_size == 0);  // If data is null, then data_size must be 0
 
+    if (per_thread_buffers_) {
+      // Records written after the calling thread's lane list is destroyed (by TLS destructors) go
+      // through the shared buffers.
+      if (Lane* lane = GetLane(); lane != nullptr)
+        return WriteLane(*lane, std::forward<Record>(record), data, data_size,
+                         std::forward<Functor>(store_data));
+    }
+
     std::lock_guard producer_lock(producer_mutex_);
 
     // The amount of memory reserved in the buffer to store data. If the data cannot fit because it
-    // is larger than the buffer size minus one record, then the data won't be copied into the
-    // buffer.
-    size_t reserve_data_size =
-        data_size <= (properties_.buffer_size - sizeof(Record)) ? data_size : 0;
+    // is larger than the buffer size minus one record, then the data is copied to the spill arena
+    // instead of the buffer.
+    const size_t record_size = RecordSize<Record>();
+    size_t reserve_data_size = data_size <= (buffer_size_ - record_size) ? data_size : 0;
 
-    std::byte* next_record = record_ptr_ + sizeof(Record);
-    if (next_record > (data_ptr_ - reserve_data_size)) {
-      NotifyConsumerThread(buffer_begin_, record_ptr_);
-      SwitchBuffers();
-      next_record = record_ptr_ + sizeof(Record);
-      assert(next_record <= buffer_end_ && "buffer size is less then the record size");
+    if (record_ptr_ + record_size > (data_ptr_ - reserve_data_size)) {
+      // If there are no free buffers and the overflow policy does not allow waiting, the record
+      // is dropped.
+      if (SwitchBuffers(true) == 0) return DropRecord(record);
+      assert(record_ptr_ + record_size <= buffer_end_ &&
+             "buffer size is less then the record size");
     }
 
-    // Store data in the record. Copy the data first if it fits in the buffer
-    // (reserve_data_size != 0).
+    // Write the pending records lost markers, if any, before this record.
+    if (records_lost_pending_.load(std::memory_order_relaxed))
+      record_ptr_ =
+          WriteRecordsLostMarkers(record_ptr_, data_ptr_ - reserve_data_size - record_size);
+
+    // Store data in the record. Copy the data first, in the buffer if it fits
+    // (reserve_data_size != 0), or in the spill arena otherwise.
     if (reserve_data_size) {
       data_ptr_ -= data_size;
       ::memcpy(data_ptr_, data, data_size);
       store_data(record, data_ptr_);
     } else if (data != nullptr) {
-      store_data(record, data);
+      store_data(record, SpillData(buffer_begin_, data, data_size));
     }
 
     // Store the record into the buffer, and increment the write pointer.
-    ::memcpy(record_ptr_, &record, sizeof(Record));
+    std::byte* next_record = StoreRecord(record_ptr_, record);
+    records_written_ += RecordCount<Record>();
+    bytes_written_ += (next_record - record_ptr_) + data_size;
     record_ptr_ = next_record;
-
-    // If the data does not fit in the buffer, flush the buffer with the record as is. We don't copy
-    // the data so we make sure that the record and its data are processed by waiting until the
-    // flush is complete.
-    if (data != nullptr && reserve_data_size == 0) {
-      NotifyConsumerThread(buffer_begin_, record_ptr_);
-      SwitchBuffers();
-      {
-        std::unique_lock consumer_lock(consumer_mutex_);
-        consumer_cond_.wait(consumer_lock, [this]() { return !consumer_arg_.valid; });
-      }
-    }
   }
   template <typename Record> void Write(Record&& record) {
     using DataPtr = void*;
     Write(std::forward<Record>(record), DataPtr(nullptr), 0, {});
   }
 
-  // Flush the records and block until they are all made visible to the client.
-  void Flush() {
+  // The maximum number of records in a reservation.
+  size_t MaxReservation() const { return buffer_size_ / RecordSize<roctracer_record_t>(); }
+
+  // Reserve 'count' contiguous, zero-initialized records in the pool, to be filled in place by the
+  // calling thread and then committed with Commit(). The records of a reservation are delivered
+  // together, after the records written before the reservation. Return nullptr if the records
+  // are dropped by the overflow policy, in which case they are accounted as lost records of
+  // 'domain'.
+  //
+  // In shared buffers mode, the producer mutex is held from Reserve() to Commit(), so the calling
+  // thread must not write records to, or flush, the pool before committing. This is only meant
+  // for the tracer's own records, see ReservePending() for the public API. In compact records
+  // mode, the records are filled in a scratch area at the end of the reserved space, and encoded
+  // in place when committed.
+  roctracer_record_t* Reserve(uint32_t domain, size_t count) {
+    assert(count != 0 && count <= MaxReservation() && "invalid reservation size");
+    const size_t size = count * RecordSize<roctracer_record_t>();
+
+    if (per_thread_buffers_) {
+      if (Lane* lane = GetLane(); lane != nullptr) return ReserveLane(*lane, domain, count);
+    }
+
+    producer_mutex_.lock();
+    if (record_ptr_ + size > data_ptr_ && SwitchBuffers(true) == 0) {
+      AddRecordsLost(domain, count);
+      producer_mutex_.unlock();
+      return nullptr;
+    }
+    if (records_lost_pending_.load(std::memory_order_relaxed))
+      record_ptr_ = WriteRecordsLostMarkers(record_ptr_, data_ptr_ - size);
+
+    // The write pointer is advanced when the records are committed, so that concurrent flushes
+    // do not submit them before they are filled.
+    reserved_end_ = record_ptr_ + size;
+    roctracer_record_t* records = ReservedRecords(record_ptr_, reserved_end_);
+    ::memset(records, 0, count * sizeof(roctracer_record_t));
+    return records;
+  }
+
+  // Commit the records returned by Reserve(), making them visible to flushes and to the consumer.
+  void Commit(roctracer_record_t* records) {
+    if (!IsPoolBuffer(reinterpret_cast<std::byte*>(records)))
+      return CommitLane(*GetLane(), records);
+
+    assert(reserved_end_ != nullptr && records == ReservedRecords(record_ptr_, reserved_end_) &&
+           "no pending reservation");
+    records_written_ += (reserved_end_ - record_ptr_) / RecordSize<roctracer_record_t>();
+    std::byte* next_record = CommitRecords(record_ptr_, std::exchange(reserved_end_, nullptr));
+    bytes_written_ += next_record - record_ptr_;
+    record_ptr_ = next_record;
+    producer_mutex_.unlock();
+  }
+
+  // Reserve 'count' records as Reserve() does, but without holding any lock until the records are
+  // committed with CommitPending() or cancelled with CancelPending(), so that the pool can be
+  // written to and flushed in between, including by the calling thread. The reserved space is
+  // queued with the other records of the shared buffers. If the consumer thread reaches the
+  // reservation before it is committed, it skips it and delivers the records that follow, and
+  // delivers the reservation on its own once committed, as the skip-incomplete flush mode of the
+  // tracer tool's trace buffers does. Flushes do not wait for pending reservations. The buffer
+  // holding a reservation is not released, or reclaimed by the overflow policy, until the
+  // reservation is delivered or cancelled.
+  roctracer_record_t* ReservePending(uint32_t domain, size_t count) {
+    assert(count != 0 && count <= MaxReservation() && "invalid reservation size");
+    const size_t size = count * RecordSize<roctracer_record_t>();
+
+    std::lock_guard producer_lock(producer_mutex_);
+    if (record_ptr_ + size > data_ptr_ && SwitchBuffers(true) == 0) {
+      AddRecordsLost(domain, count);
+      return nullptr;
+    }
+    if (records_lost_pending_.load(std::memory_order_relaxed))
+      record_ptr_ = WriteRecordsLostMarkers(record_ptr_, data_ptr_ - size);
+
+    std::byte* begin = std::exchange(record_ptr_, record_ptr_ + size);
+    records_written_ += count;
+    bytes_written_ += size;
+    roctracer_record_t* records = ReservedRecords(begin, record_ptr_);
+    ::memset(records, 0, count * sizeof(roctracer_record_t));
+
+    std::lock_guard consumer_lock(consumer_mutex_);
+    pending_reservations_.push_back({begin, record_ptr_, nullptr, false});
+    return records;
+  }
+
+  // Commit the records returned by ReservePending(), and let the consumer thread deliver them.
+  // Return false if 'records' is not a pending reservation.
+  bool CommitPending(roctracer_record_t* records) {
+    {
+      std::lock_guard consumer_lock(consumer_mutex_);
+      auto it = FindPendingReservation(records);
+      if (it == pending_reservations_.end()) return false;
+      it->committed_end = CommitRecords(it->begin, it->end);
+    }
+    ConsumerExecutor::Instance().Schedule(*this);
+    return true;
+  }
+
+  // Cancel the records returned by ReservePending(): they are not delivered, and are no longer
+  // accounted as written. Return false if 'records' is not a pending reservation.
+  bool CancelPending(roctracer_record_t* records) {
     {
       std::lock_guard producer_lock(producer_mutex_);
-      if (record_ptr_ == buffer_begin_) return;
+      std::lock_guard consumer_lock(consumer_mutex_);
+      auto it = FindPendingReservation(records);
+      if (it == pending_reservations_.end()) return false;
+      records_written_ -= (it->end - it->begin) / RecordSize<roctracer_record_t>();
+      bytes_written_ -= it->end - it->begin;
+      it->committed_end = it->begin;
+    }
+    ConsumerExecutor::Instance().Schedule(*this);
+    return true;
+  }
 
-      NotifyConsumerThread(buffer_begin_, record_ptr_);
-      SwitchBuffers();
+  // Write a string definition record for the interned string 'id', unless one was already written
+  // to this pool. The string is copied into the pool's data.
+  //
+  // The string is marked as defined while its definition is stored, with the producer mutex (or
+  // the lane) held, so that the records referring to it written by the threads seeing the mark
+  // follow the definition. Threads using the string for the first time concurrently may each write
+  // a definition. If the definition is dropped by the overflow policy, the string is not marked,
+  // and if it is discarded later, the mark is cleared (see DiscardRecords).
+  void DefineString(uint32_t id, const char* string) {
+    std::atomic<uint64_t>* word = nullptr;
+    uint64_t bit = 0;
+    if (id < kMaxDefinedStrings) {
+      word = &defined_strings_[id / 64];
+      bit = uint64_t{1} << (id % 64);
+      if ((word->load(std::memory_order_acquire) & bit) != 0) return;
     }
+
+    roctracer_record_t record{};
+    record.domain = ACTIVITY_DOMAIN_EXT_API;
+    record.op = ACTIVITY_EXT_OP_STRING_DEFINITION;
+    record.string_id = id;
+    Write(record, string, strlen(string) + 1, [word, bit](auto& record, const void* data) {
+      record.string = static_cast<const char*>(data);
+      if (word != nullptr) word->fetch_or(bit, std::memory_order_release);
+    });
+  }
+
+  // Flush the records and block until they are all made visible to the client, except the
+  // pending reservations, which are delivered once committed.
+  void Flush() {
+    // Wait for the operations queued by this flush to complete.
+    if (uint64_t ticket = SubmitRecords(true); ticket != 0) WaitForConsumerThread(ticket);
+  }
+
+  // Flush the records without waiting for them to be processed. If 'completion' is not null, it
+  // is called with 'arg' by the consumer thread once all the records are made visible to the
+  // client.
+  void FlushAsync(void (*completion)(void* arg), void* arg) {
+    SubmitRecords(false);
+    if (completion != nullptr) NotifyConsumerThread(nullptr, nullptr, nullptr, completion, arg);
+  }
+
+  // Return the number of records of the given domain dropped because of the overflow policy.
+  uint64_t RecordsLost(uint32_t domain) const {
+    assert(domain < records_lost_.size() && "domain is out of range");
+    return records_lost_[domain].load(std::memory_order_relaxed);
+  }
+
+  // Return a snapshot of the pool statistics. The counters are read under different locks, so they
+  // may not be consistent with each other if records are written concurrently.
+  roctracer_pool_stats_t GetStats() {
+    roctracer_pool_stats_t stats{};
     {
-      // Wait for the current operation to complete.
-      std::unique_lock consumer_lock(consumer_mutex_);
-      consumer_cond_.wait(consumer_lock, [this]() { return !consumer_arg_.valid; });
+      std::lock_guard producer_lock(producer_mutex_);
+      stats.records = records_written_;
+      stats.bytes = bytes_written_;
+    }
+    {
+      std::lock_guard lanes_lock(lanes_mutex_);
+      stats.records += retired_records_written_;
+      stats.bytes += retired_bytes_written_;
+      for (auto&& lane : lanes_) {
+        stats.records += lane->records_written.load(std::memory_order_relaxed);
+        stats.bytes += lane->bytes_written.load(std::memory_order_relaxed);
+      }
     }
+    {
+      std::lock_guard consumer_lock(consumer_mutex_);
+      stats.flushes = flushes_;
+      stats.buffer_switches = buffer_switches_;
+      stats.producer_wait_ns = producer_wait_ns_;
+      stats.callbacks = callbacks_;
+      stats.callback_ns = callback_ns_;
+      stats.max_callback_ns = max_callback_ns_;
+      stats.queued_bytes = queued_bytes_;
+      stats.max_queued_bytes = max_queued_bytes_;
+    }
+    for (auto&& records_lost : records_lost_)
+      stats.dropped_records += records_lost.load(std::memory_order_relaxed);
+    return stats;
   }
 
  private:
-  void SwitchBuffers() {
-    buffer_begin_ = (buffer_end_ == pool_end_) ? pool_begin_ : buffer_end_;
-    buffer_end_ = buffer_begin_ + properties_.buffer_size;
+  // A reservation made with ReservePending(). 'committed_end' is the end of the committed records
+  // (equal to 'begin' if cancelled), or null until the reservation is committed. 'skipped' is true
+  // once the consumer thread delivered the records following it.
+  struct PendingReservation {
+    std::byte* begin;
+    std::byte* end;
+    std::byte* committed_end;
+    bool skipped;
+  };
+
+  // A lane is a buffer owned by a single producer thread. The owner appends records with plain
+  // stores and publishes them by advancing 'committed'. The committed records that were not yet
+  // handed to the consumer thread ([submitted, committed)) are submitted when the lane is full or
+  // when the pool is flushed.
+  struct Lane {
+    std::byte* buffer_begin{nullptr};
+    std::byte* buffer_end{nullptr};
+    std::byte* record_ptr{nullptr};  // Only accessed by the owner thread.
+    std::byte* data_ptr{nullptr};    // Only accessed by the owner thread.
+    std::atomic<std::byte*> committed{nullptr};
+    std::byte* submitted{nullptr};  // Protected by 'mutex'.
+    std::mutex mutex;
+
+    std::atomic<bool> orphaned{false};  // The owner thread has exited.
+    std::atomic<bool> closed{false};    // The pool owning this lane was destroyed.
+
+    // The end of the records reserved but not yet committed, only accessed by the owner thread.
+    std::byte* reserved_end{nullptr};
+
+    // Statistics, written by the owner thread only.
+    std::atomic<uint64_t> records_written{0};
+    std::atomic<uint64_t> bytes_written{0};
+  };
+
+  // The lanes owned by a thread, one per pool in per-thread buffers mode. The lanes are shared with
+  // the pools so that either the thread or the pool can go away first. As for the correlation ID
+  // stacks, the list is marked invalid when destructed so that late writes from other TLS
+  // destructors can detect it and use the shared buffers instead.
+  class LaneList {
+   public:
+    LaneList() { valid_.store(true, std::memory_order_relaxed); }
+    ~LaneList() {
+      valid_.store(false, std::memory_order_relaxed);
+      for (auto&& [pool_id, lane] : lanes_) lane->orphaned.store(true, std::memory_order_release);
+    }
+
+    Lane* Find(uint64_t pool_id) const {
+      for (auto&& [id, lane] : lanes_)
+        if (id == pool_id) return lane.get();
+      return nullptr;
+    }
+
+    void Add(uint64_t pool_id, std::shared_ptr<Lane> lane) {
+      // Drop the lanes of pools that no longer exist before adding a new one.
+      lanes_.erase(std::remove_if(lanes_.begin(), lanes_.end(),
+                                  [](auto&& entry) {
+                                    return entry.second->closed.load(std::memory_order_relaxed);
+                                  }),
+                   lanes_.end());
+      lanes_.emplace_back(pool_id, std::move(lane));
+    }
+
+    bool is_valid() const { return valid_.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<bool> valid_{false};
+    std::vector<std::pair<uint64_t, std::shared_ptr<Lane>>> lanes_;
+  };
+
+  // Return the calling thread's lane for this pool, creating it if necessary, or nullptr if the
+  // thread's lane list was already destructed.
+  Lane* GetLane() {
+    static thread_local LaneList thread_lanes;
+    if (!thread_lanes.is_valid()) return nullptr;
+    if (Lane* lane = thread_lanes.Find(id_); lane != nullptr) return lane;
+
+    auto lane = std::make_shared<Lane>();
+    SetLaneBuffer(*lane, TakeLaneBuffer(false, true));
+    {
+      std::lock_guard lanes_lock(lanes_mutex_);
+      lanes_.push_back(lane);
+    }
+    thread_lanes.Add(id_, lane);
+    return lane.get();
+  }
+
+  template <typename Record, typename Functor>
+  void WriteLane(Lane& lane, Record&& record, const void* data, size_t data_size,
+                 Functor&& store_data) {
+    const size_t record_size = RecordSize<Record>();
+    size_t reserve_data_size = data_size <= (buffer_size_ - record_size) ? data_size : 0;
+
+    if (lane.record_ptr + record_size > (lane.data_ptr - reserve_data_size)) {
+      // The lane is full, hand over its remaining records and the buffer itself to the consumer
+      // thread, and continue in a new buffer. The consumer returns the buffer to the free list
+      // once processed. If there are no free buffers and the overflow policy does not allow
+      // waiting, the record is dropped.
+      std::byte* buffer = TakeLaneBuffer(true);
+      if (buffer == nullptr) return DropRecord(record);
+
+      std::lock_guard lane_lock(lane.mutex);
+      SubmitLane(lane, true);
+      SetLaneBuffer(lane, buffer);
+      assert(lane.record_ptr + record_size <= lane.buffer_end &&
+             "buffer size is less then the record size");
+    }
+
+    if (records_lost_pending_.load(std::memory_order_relaxed))
+      lane.record_ptr = WriteRecordsLostMarkers(
+          lane.record_ptr, lane.data_ptr - reserve_data_size - record_size);
+
+    if (reserve_data_size) {
+      lane.data_ptr -= data_size;
+      ::memcpy(lane.data_ptr, data, data_size);
+      store_data(record, lane.data_ptr);
+    } else if (data != nullptr) {
+      store_data(record, SpillData(lane.buffer_begin, data, data_size));
+    }
+
+    std::byte* next_record = StoreRecord(lane.record_ptr, record);
+    AddLaneStats(lane, RecordCount<Record>(), (next_record - lane.record_ptr) + data_size);
+    lane.record_ptr = next_record;
+    lane.committed.store(next_record, std::memory_order_release);
+  }
+
+  // See Reserve().
+  roctracer_record_t* ReserveLane(Lane& lane, uint32_t domain, size_t count) {
+    const size_t size = count * RecordSize<roctracer_record_t>();
+
+    if (lane.record_ptr + size > lane.data_ptr) {
+      std::byte* buffer = TakeLaneBuffer(true);
+      if (buffer == nullptr) {
+        AddRecordsLost(domain, count);
+        return nullptr;
+      }
+
+      std::lock_guard lane_lock(lane.mutex);
+      SubmitLane(lane, true);
+      SetLaneBuffer(lane, buffer);
+    }
+    if (records_lost_pending_.load(std::memory_order_relaxed))
+      lane.record_ptr = WriteRecordsLostMarkers(lane.record_ptr, lane.data_ptr - size);
+
+    // The records are published when committed, flushes only submit the committed records.
+    lane.reserved_end = lane.record_ptr + size;
+    roctracer_record_t* records = ReservedRecords(lane.record_ptr, lane.reserved_end);
+    ::memset(records, 0, count * sizeof(roctracer_record_t));
+    return records;
+  }
+
+  // See Commit().
+  void CommitLane(Lane& lane, [[maybe_unused]] roctracer_record_t* records) {
+    assert(lane.reserved_end != nullptr &&
+           records == ReservedRecords(lane.record_ptr, lane.reserved_end) &&
+           "no pending reservation");
+    const size_t count = (lane.reserved_end - lane.record_ptr) / RecordSize<roctracer_record_t>();
+    std::byte* next_record =
+        CommitRecords(lane.record_ptr, std::exchange(lane.reserved_end, nullptr));
+    AddLaneStats(lane, count, next_record - lane.record_ptr);
+    lane.record_ptr = next_record;
+    lane.committed.store(next_record, std::memory_order_release);
+  }
+
+  // Only the owner thread updates the lane's counters, they do not need atomic increments.
+  static void AddLaneStats(Lane& lane, uint64_t records, uint64_t bytes) {
+    lane.records_written.store(lane.records_written.load(std::memory_order_relaxed) + records,
+                               std::memory_order_relaxed);
+    lane.bytes_written.store(lane.bytes_written.load(std::memory_order_relaxed) + bytes,
+                             std::memory_order_relaxed);
+  }
+
+  // Hand the lane's committed records that were not yet submitted to the consumer thread. If
+  // 'release' is true, the lane's buffer is also returned to the free list once processed. Return
+  // the ticket of the queued operation, or 0 if there was nothing to submit. Must be called with
+  // the lane's mutex held.
+  uint64_t SubmitLane(Lane& lane, bool release) {
+    std::byte* committed = lane.committed.load(std::memory_order_acquire);
+    if (committed == lane.submitted && !release) return 0;
+
+    uint64_t ticket =
+        NotifyConsumerThread(lane.submitted, committed, release ? lane.buffer_begin : nullptr);
+    lane.submitted = committed;
+    return ticket;
+  }
+
+  // Submit all the lanes' pending records, and release the lanes whose owner thread has exited.
+  // Return the ticket of the last queued operation, or 0 if nothing was submitted.
+  uint64_t FlushLanes() {
+    uint64_t ticket = 0;
+
+    std::lock_guard lanes_lock(lanes_mutex_);
+    for (auto it = lanes_.begin(); it != lanes_.end();) {
+      Lane& lane = **it;
+      bool orphaned;
+      {
+        std::lock_guard lane_lock(lane.mutex);
+        orphaned = lane.orphaned.load(std::memory_order_acquire);
+        ticket = std::max(ticket, SubmitLane(lane, orphaned));
+      }
+      if (orphaned) {
+        retired_records_written_ += lane.records_written.load(std::memory_order_relaxed);
+        retired_bytes_written_ += lane.bytes_written.load(std::memory_order_relaxed);
+
+        std::lock_guard consumer_lock(consumer_mutex_);
+        --lane_count_;
+        it = lanes_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return ticket;
+  }
+
+  // Return an empty lane buffer, taken from the free list if one is available. Each lane owns a
+  // buffer, and up to 'buffer_count_' more buffers can be queued for the consumer thread. If this
+  // limit is reached, wait for a buffer to be released, or if 'may_drop' is true, apply the
+  // overflow policy and return nullptr if the new record should be dropped. 'new_lane' is true if
+  // the buffer is for a new lane.
+  std::byte* TakeLaneBuffer(bool may_drop, bool new_lane = false) {
+    std::unique_lock consumer_lock(consumer_mutex_);
+    if (new_lane) ++lane_count_;
+
+    while (free_lane_buffers_.empty()) {
+      if (lane_buffers_.size() < lane_count_ + buffer_count_) {
+        std::byte* buffer = nullptr;
+        AllocateMemory(&buffer, buffer_size_);
+        assert(buffer != nullptr && "pool allocator failed");
+        lane_buffers_.push_back(buffer);
+        return buffer;
+      }
+
+      if (may_drop && overflow_policy_ == ROCTRACER_POOL_OVERFLOW_DROP_OLDEST &&
+          ReclaimOldestBuffer(false))
+        break;
+      if (may_drop && overflow_policy_ != ROCTRACER_POOL_OVERFLOW_BLOCK) return nullptr;
+      ProducerWait(consumer_lock, [this]() { return !free_lane_buffers_.empty(); });
+    }
+
+    std::byte* buffer = free_lane_buffers_.back();
+    free_lane_buffers_.pop_back();
+    return buffer;
+  }
+
+  void SetLaneBuffer(Lane& lane, std::byte* buffer) {
+    lane.buffer_begin = buffer;
+    lane.buffer_end = buffer + buffer_size_;
+    lane.record_ptr = lane.buffer_begin;
+    lane.data_ptr = lane.buffer_end;
+    lane.submitted = lane.buffer_begin;
+    lane.committed.store(lane.buffer_begin, std::memory_order_relaxed);
+  }
+
+  void SetBuffer(std::byte* buffer) {
+    buffer_begin_ = buffer;
+    buffer_end_ = buffer_begin_ + buffer_size_;
     record_ptr_ = buffer_begin_;
+    submitted_ptr_ = buffer_begin_;
     data_ptr_ = buffer_end_;
   }
 
-  void ConsumerThreadLoop(std::promise<void> ready) {
+  // Queue the records written since the last submission for the consumer thread, without
+  // releasing the buffers they are in. If 'wait' is false, the records lost markers that do not
+  // fit in the current buffer are left to be written with the next record, instead of waiting for
+  // a free buffer. Return the ticket of the last operation queued, or 0 if there was nothing to
+  // submit.
+  uint64_t SubmitRecords(bool wait) {
+    uint64_t ticket = 0;
+    if (per_thread_buffers_) ticket = FlushLanes();
+
+    std::lock_guard producer_lock(producer_mutex_);
+    if (uint64_t buffer_ticket = SubmitBuffer(wait); buffer_ticket != 0) ticket = buffer_ticket;
+    return ticket;
+  }
+
+  // Queue the records written in the current buffer since the last submission. Must be called
+  // with the producer mutex held. See SubmitRecords.
+  uint64_t SubmitBuffer(bool wait) {
+    // Make sure the records lost markers are delivered with this flush.
+    if (records_lost_pending_.load(std::memory_order_relaxed)) {
+      record_ptr_ = WriteRecordsLostMarkers(record_ptr_, data_ptr_);
+      if (wait && records_lost_pending_.load(std::memory_order_relaxed)) {
+        SwitchBuffers();
+        record_ptr_ = WriteRecordsLostMarkers(record_ptr_, data_ptr_);
+      }
+    }
+
+    if (record_ptr_ == submitted_ptr_) return 0;
+    uint64_t ticket = NotifyConsumerThread(submitted_ptr_, record_ptr_);
+    submitted_ptr_ = record_ptr_;
+    return ticket;
+  }
+
+  // Periodic flush, called by the consumer executor every 'flush_interval_ns'. Producers are not
+  // waited for: if the shared buffer is in use, its records are submitted at the next period.
+  void Tick() override {
+    if (per_thread_buffers_) FlushLanes();
+
+    std::unique_lock producer_lock(producer_mutex_, std::try_to_lock);
+    if (producer_lock.owns_lock()) SubmitBuffer(false);
+  }
+
+  // Queue the current buffer for the consumer thread and continue writing in a free buffer, waiting
+  // for one to be released if all the buffers are in use. If 'may_drop' is true, apply the
+  // overflow policy instead of waiting, and return 0 without switching buffers if the new record
+  // should be dropped. Return the ticket of the queued operation. Must be called with the producer
+  // mutex held.
+  uint64_t SwitchBuffers(bool may_drop = false) {
+    if (may_drop && overflow_policy_ != ROCTRACER_POOL_OVERFLOW_BLOCK) {
+      // Only producers holding the producer mutex take pool buffers, so a free buffer found here
+      // is still available below.
+      std::lock_guard consumer_lock(consumer_mutex_);
+      if (free_buffers_.empty() &&
+          (overflow_policy_ != ROCTRACER_POOL_OVERFLOW_DROP_OLDEST || !ReclaimOldestBuffer(true)))
+        return 0;
+    }
+
+    uint64_t ticket = NotifyConsumerThread(submitted_ptr_, record_ptr_, buffer_begin_);
+
     std::unique_lock consumer_lock(consumer_mutex_);
+    ProducerWait(consumer_lock, [this]() { return !free_buffers_.empty(); });
+    SetBuffer(free_buffers_.front());
+    free_buffers_.pop_front();
+    return ticket;
+  }
 
-    // This consumer is now ready to accept work.
-    ready.set_value();
+  // Return the buffer to its free list, and recycle the spilled data of its records. Must be called
+  // with the consumer mutex held.
+  void ReleaseBuffer(std::byte* buffer) {
+    if (IsPoolBuffer(buffer))
+      free_buffers_.push_back(buffer);
+    else
+      free_lane_buffers_.push_back(buffer);
 
-    while (true) {
-      consumer_cond_.wait(consumer_lock, [this]() { return consumer_arg_.valid; });
+    auto it = buffer_spills_.find(buffer);
+    if (it == buffer_spills_.end()) return;
+    for (auto&& spill : it->second) {
+      // Keep the spill blocks for reuse, but do not hold on to more idle memory than the buffers.
+      if (free_spill_size_ + spill.size <= buffer_count_ * buffer_size_) {
+        free_spill_size_ += spill.size;
+        free_spills_.push_back(spill);
+      } else {
+        free(spill.data);
+      }
+    }
+    buffer_spills_.erase(it);
+  }
 
-      // begin == end == nullptr means the thread needs to exit.
-      if (consumer_arg_.begin == nullptr && consumer_arg_.end == nullptr) break;
+  // Copy data too large to fit in a buffer to a spill block, and return the copy. The block is
+  // attached to 'buffer', the buffer the record referring to the data is written to, and is
+  // recycled once the buffer's records are processed. This lets the producer continue without
+  // waiting for the record to be processed.
+  const void* SpillData(const std::byte* buffer, const void* data, size_t data_size) {
+    Spill spill{nullptr, 0};
+    {
+      std::lock_guard consumer_lock(consumer_mutex_);
+      auto it = std::find_if(free_spills_.begin(), free_spills_.end(),
+                             [data_size](auto&& spill) { return spill.size >= data_size; });
+      if (it != free_spills_.end()) {
+        spill = *it;
+        free_spill_size_ -= spill.size;
+        free_spills_.erase(it);
+      }
+    }
 
-      properties_.buffer_callback_fun(reinterpret_cast<const char*>(consumer_arg_.begin),
-                                      reinterpret_cast<const char*>(consumer_arg_.end),
-                                      properties_.buffer_callback_arg);
+    if (spill.data == nullptr) {
+      // Round the block size up to the page size so that blocks can be reused for similar sizes.
+      constexpr size_t kSpillAlignment = 4096;
+      spill.size = (data_size + kSpillAlignment - 1) & ~(kSpillAlignment - 1);
+      spill.data = static_cast<std::byte*>(malloc(spill.size));
+      assert(spill.data != nullptr && "spill allocation failed");
+    }
+    ::memcpy(spill.data, data, data_size);
 
-      // Mark this operation as complete (valid=false) and notify all producers that may be
-      // waiting for this operation to finish, or to start a new operation. See comment below in
-      // NotifyConsumerThread().
-      consumer_arg_.valid = false;
-      consumer_cond_.notify_all();
+    std::lock_guard consumer_lock(consumer_mutex_);
+    buffer_spills_[buffer].push_back(spill);
+    return spill.data;
+  }
+
+  bool IsPoolBuffer(const std::byte* buffer) const {
+    return buffer >= pool_begin_ && buffer < pool_begin_ + buffer_count_ * buffer_size_;
+  }
+
+  static bool InBuffer(const std::byte* ptr, const std::byte* buffer, size_t buffer_size) {
+    return ptr >= buffer && ptr < buffer + buffer_size;
+  }
+
+  // Discard the records of the oldest queued buffer (a pool buffer if 'pool_buffer' is true, or a
+  // lane buffer otherwise) that the consumer thread has not started processing and that holds no
+  // pending reservation, and return the buffer to its free list. The records of the buffer
+  // submitted by earlier flushes are discarded as well. The operations stay in the queue, without
+  // records, so that tickets still complete in order. Return false if no such buffer is queued.
+  // Must be called with the consumer mutex held.
+  bool ReclaimOldestBuffer(bool pool_buffer) {
+    auto it = std::find_if(consumer_queue_.begin(), consumer_queue_.end(), [&](auto&& arg) {
+      return arg.release != nullptr && IsPoolBuffer(arg.release) == pool_buffer &&
+          !InBuffer(consumer_busy_ptr_, arg.release, buffer_size_) &&
+          std::none_of(pending_reservations_.begin(), pending_reservations_.end(),
+                       [&](auto&& reservation) {
+                         return InBuffer(reservation.begin, arg.release, buffer_size_);
+                       });
+    });
+    if (it == consumer_queue_.end()) return false;
+
+    std::byte* buffer = it->release;
+    for (auto jt = consumer_queue_.begin(); jt != std::next(it); ++jt) {
+      if (!InBuffer(jt->begin, buffer, buffer_size_)) continue;
+
+      DiscardRecords(jt->begin, jt->end);
+      queued_bytes_ -= jt->end - jt->begin;
+      jt->end = jt->begin;
+    }
+
+    ReleaseBuffer(buffer);
+    it->release = nullptr;
+    return true;
+  }
+
+  // Account for the records in [begin, end) as lost, and return their number.
+  uint64_t DiscardRecords(const std::byte* begin, const std::byte* end) {
+    uint64_t count = 0;
+    ForEachRecord(begin, end, [this, &count](const roctracer_record_t& record) {
+      // The records counted by a discarded marker are already accounted for, and only need to be
+      // reported again by the next marker.
+      if (record.domain == ACTIVITY_DOMAIN_EXT_API && record.op == ACTIVITY_EXT_OP_RECORDS_LOST) {
+        AddRecordsLost(record.kind, record.records_lost, false);
+        return;
+      }
+      // A discarded string definition must be written again the next time the string is used.
+      if (record.domain == ACTIVITY_DOMAIN_EXT_API &&
+          record.op == ACTIVITY_EXT_OP_STRING_DEFINITION && record.string_id < kMaxDefinedStrings)
+        defined_strings_[record.string_id / 64].fetch_and(~(uint64_t{1} << (record.string_id % 64)),
+                                                          std::memory_order_relaxed);
+      AddRecordsLost(record.domain, 1);
+      ++count;
+    });
+    return count;
+  }
+
+  // Copy the records in [begin, end) to a chunk of the shared memory ring, each string definition
+  // followed by its string as the string pointers are not valid in other processes. If the ring
+  // is full, the records are dropped, after waiting for the reader with the blocking overflow
+  // policy. The wait is bounded, so that a missing reader does not stall the consumer thread, and
+  // with it the flushes and the destruction of the pool. Called by the consumer thread.
+  void PublishRecords(const std::byte* begin, const std::byte* end) {
+    publish_buffer_.clear();
+    auto append = [this](const void* data, size_t size) {
+      auto* bytes = static_cast<const std::byte*>(data);
+      publish_buffer_.insert(publish_buffer_.end(), bytes, bytes + size);
+    };
+
+    for (const std::byte* ptr = begin; ptr < end;) {
+      roctracer_record_t record;
+      const std::byte* next;
+      if (compact_records_) {
+        next = compact_record::Decode(ptr, end, time_base_ns_, &record);
+        if (next == nullptr) break;
+      } else {
+        ::memcpy(&record, ptr, sizeof(record));
+        next = ptr + sizeof(record);
+      }
+
+      if (record.domain != ACTIVITY_DOMAIN_EXT_API ||
+          record.op != ACTIVITY_EXT_OP_STRING_DEFINITION || record.string == nullptr) {
+        append(ptr, next - ptr);
+      } else {
+        const char* string = record.string;
+        record.string = nullptr;
+        std::byte stored[std::max(sizeof(record), compact_record::kMaxRecordSize)];
+        append(stored, StoreRecord(stored, record) - stored);
+
+        const size_t length = strlen(string) + 1;
+        append(string, length);
+        publish_buffer_.resize(publish_buffer_.size() + (-length & 7), std::byte{0});
+      }
+      ptr = next;
+    }
+
+    if (!shared_ring_->Publish(publish_buffer_.data(), publish_buffer_.size(),
+                               overflow_policy_ == ROCTRACER_POOL_OVERFLOW_BLOCK
+                                   ? kSharedMemoryWaitTimeout
+                                   : std::chrono::nanoseconds{0}))
+      shared_ring_->AddRecordsLost(DiscardRecords(begin, end));
+  }
+
+  // The number of activity records in a record, which is an activity record or an array of them.
+  template <typename Record> static constexpr size_t RecordCount() {
+    return sizeof(std::decay_t<Record>) / sizeof(roctracer_record_t);
+  }
+
+  // The space needed to store a record in a buffer, the largest encoded size in compact records
+  // mode.
+  template <typename Record> size_t RecordSize() const {
+    return compact_records_ ? RecordCount<Record>() * compact_record::kMaxRecordSize
+                            : sizeof(std::decay_t<Record>);
+  }
+
+  // Store the record at 'ptr', encoded in compact records mode, and return the end of the stored
+  // record.
+  template <typename Record> std::byte* StoreRecord(std::byte* ptr, const Record& record) const {
+    if (compact_records_) {
+      if constexpr (std::is_same_v<Record, roctracer_record_t>) {
+        return compact_record::Encode(record, time_base_ns_, ptr);
+      } else {
+        for (auto&& element : record) ptr = StoreRecord(ptr, element);
+        return ptr;
+      }
+    }
+    ::memcpy(ptr, &record, sizeof(Record));
+    return ptr + sizeof(Record);
+  }
+
+  // Call 'function' with each record stored in [begin, end), decoded in compact records mode.
+  template <typename Function>
+  void ForEachRecord(const std::byte* begin, const std::byte* end, Function&& function) const {
+    if (compact_records_) {
+      for (compact_record::Iterator it(begin, end, time_base_ns_); it.Next();) function(*it);
+      return;
+    }
+    for (auto* record = reinterpret_cast<const roctracer_record_t*>(begin);
+         record < reinterpret_cast<const roctracer_record_t*>(end); ++record)
+      function(*record);
+  }
+
+  // Return where the caller fills the records reserved in [begin, end). In compact records mode,
+  // the records are filled at the end of the reserved space, aligned, so that CommitRecords() can
+  // encode each record at the beginning of the space without overwriting the next records.
+  roctracer_record_t* ReservedRecords(std::byte* begin, std::byte* end) const {
+    if (!compact_records_) return reinterpret_cast<roctracer_record_t*>(begin);
+    const size_t count = (end - begin) / compact_record::kMaxRecordSize;
+    auto records = reinterpret_cast<uintptr_t>(end - count * sizeof(roctracer_record_t));
+    return reinterpret_cast<roctracer_record_t*>(records & ~(alignof(roctracer_record_t) - 1));
+  }
+
+  // Return the end of the records reserved in [begin, end), once committed. In compact records
+  // mode, the records are encoded in place.
+  std::byte* CommitRecords(std::byte* begin, std::byte* end) const {
+    if (!compact_records_) return end;
+    const size_t count = (end - begin) / compact_record::kMaxRecordSize;
+    const roctracer_record_t* records = ReservedRecords(begin, end);
+    for (size_t i = 0; i < count; ++i) {
+      // Copy the record first, its encoding may overlap it.
+      const roctracer_record_t record = records[i];
+      begin = compact_record::Encode(record, time_base_ns_, begin);
+    }
+    return begin;
+  }
+
+  // Account for a record dropped by the overflow policy. 'Record' is either an activity record or
+  // an array of activity records written together (external correlation ID record pairs).
+  template <typename Record> void DropRecord(const Record& record) {
+    if constexpr (std::is_same_v<std::decay_t<Record>, roctracer_record_t>) {
+      AddRecordsLost(record.domain, 1);
+    } else {
+      for (auto&& element : record) DropRecord(element);
+    }
+  }
+
+  void AddRecordsLost(uint32_t domain, uint64_t count, bool new_records = true) {
+    if (domain >= records_lost_.size()) return;
+    if (new_records) records_lost_[domain].fetch_add(count, std::memory_order_relaxed);
+    records_lost_marker_[domain].fetch_add(count, std::memory_order_relaxed);
+    records_lost_pending_.store(true, std::memory_order_relaxed);
+  }
+
+  // Write a records lost marker for each domain with records dropped since the last markers were
+  // written, starting at 'record_ptr' without writing past 'limit'. Return the pointer following
+  // the last marker written.
+  std::byte* WriteRecordsLostMarkers(std::byte* record_ptr, const std::byte* limit) {
+    records_lost_pending_.store(false, std::memory_order_relaxed);
+
+    for (uint32_t domain = 0; domain < records_lost_marker_.size(); ++domain) {
+      if (records_lost_marker_[domain].load(std::memory_order_relaxed) == 0) continue;
+
+      if (record_ptr + RecordSize<roctracer_record_t>() > limit) {
+        // Not enough space left, write the remaining markers later.
+        records_lost_pending_.store(true, std::memory_order_relaxed);
+        break;
+      }
+
+      roctracer_record_t marker{};
+      marker.domain = ACTIVITY_DOMAIN_EXT_API;
+      marker.op = ACTIVITY_EXT_OP_RECORDS_LOST;
+      marker.kind = domain;
+      marker.records_lost = records_lost_marker_[domain].exchange(0, std::memory_order_relaxed);
+      record_ptr = StoreRecord(record_ptr, marker);
     }
+    return record_ptr;
   }
 
-  void NotifyConsumerThread(const std::byte* data_begin, const std::byte* data_end) {
+  // Process the operations queued for the consumer, in queue order. Called by a consumer
+  // executor worker thread, which runs the pool again later if operations remain queued, so that
+  // a busy pool does not starve the other pools.
+  bool Run() override {
+    constexpr size_t kMaxOperationsPerRun = 16;
     std::unique_lock consumer_lock(consumer_mutex_);
 
-    // If consumer_arg_ is still in use (valid=true), then wait for the consumer thread to finish
-    // processing the current operation. Multiple producers may wait here, one will be allowed to
-    // continue once the consumer thread is idle and valid=false. This prevents a race condition
-    // where operations would be lost if multiple producers could enter this critical section
-    // (sequentially) before the consumer thread could re-acquire the consumer_mutex_ lock.
-    consumer_cond_.wait(consumer_lock, [this]() { return !consumer_arg_.valid; });
+    // Deliver the reservations skipped by the previous runs that are now committed or cancelled.
+    DeliverSkippedReservations(consumer_lock);
+
+    for (size_t i = 0; i < kMaxOperationsPerRun && !consumer_queue_.empty(); ++i) {
+      ConsumerArg& front = consumer_queue_.front();
+
+      // If the records hold a pending reservation, deliver the records before it, then the
+      // reservation if it is committed. Otherwise, skip the reservation, it is delivered by the
+      // run following its commit. The operation stays at the front of the queue until all its
+      // records are delivered.
+      auto reservation = std::find_if(
+          pending_reservations_.begin(), pending_reservations_.end(),
+          [&front](auto&& reservation) {
+            return !reservation.skipped && reservation.begin >= front.begin &&
+                reservation.begin < front.end;
+          });
+      if (reservation != pending_reservations_.end()) {
+        const std::byte* begin = front.begin;
+        PendingReservation pending = *reservation;
+        if (pending.committed_end == nullptr)
+          reservation->skipped = true;
+        else
+          pending_reservations_.erase(reservation);
+        front.begin = pending.end;
+        queued_bytes_ -= front.begin - begin;
+
+        DeliverRecords(consumer_lock, begin, pending.begin);
+        if (pending.committed_end != nullptr)
+          DeliverRecords(consumer_lock, pending.begin, pending.committed_end);
+        continue;
+      }
+
+      ConsumerArg arg = front;
+      consumer_queue_.pop_front();
+      DeliverRecords(consumer_lock, arg.begin, arg.end, arg.completion, arg.completion_arg);
+      queued_bytes_ -= arg.end - arg.begin;
+
+      // Return the buffer to its free list now that its records are processed, unless it holds a
+      // skipped reservation, in which case it is released once the reservation is delivered.
+      if (arg.release != nullptr) {
+        if (HoldsPendingReservation(arg.release))
+          held_buffers_.push_back(arg.release);
+        else
+          ReleaseBuffer(arg.release);
+      }
+
+      // Mark this operation as complete and notify all producers that may be waiting for this
+      // operation to finish, or for a free buffer.
+      ++completed_ticket_;
+      consumer_cond_.notify_all();
+    }
+    return !consumer_queue_.empty();
+  }
+
+  // Deliver the skipped reservations that are committed, and release the buffers that no longer
+  // hold a skipped reservation. Must be called with the consumer mutex held.
+  void DeliverSkippedReservations(std::unique_lock<std::mutex>& consumer_lock) {
+    while (true) {
+      auto reservation = std::find_if(
+          pending_reservations_.begin(), pending_reservations_.end(), [](auto&& reservation) {
+            return reservation.skipped && reservation.committed_end != nullptr;
+          });
+      if (reservation == pending_reservations_.end()) break;
+      PendingReservation pending = *reservation;
+      pending_reservations_.erase(reservation);
+      DeliverRecords(consumer_lock, pending.begin, pending.committed_end);
+    }
+
+    auto held = std::remove_if(held_buffers_.begin(), held_buffers_.end(), [this](auto* buffer) {
+      if (HoldsPendingReservation(buffer)) return false;
+      ReleaseBuffer(buffer);
+      return true;
+    });
+    if (held != held_buffers_.end()) {
+      held_buffers_.erase(held, held_buffers_.end());
+      consumer_cond_.notify_all();
+    }
+  }
+
+  // Return the pending reservation whose records are 'records'. Must be called with the consumer
+  // mutex held.
+  std::vector<PendingReservation>::iterator FindPendingReservation(roctracer_record_t* records) {
+    return std::find_if(
+        pending_reservations_.begin(), pending_reservations_.end(), [&](auto&& reservation) {
+          return reservation.committed_end == nullptr &&
+              ReservedRecords(reservation.begin, reservation.end) == records;
+        });
+  }
+
+  // Return true if the buffer holds a pending reservation. Must be called with the consumer mutex
+  // held.
+  bool HoldsPendingReservation(const std::byte* buffer) const {
+    return std::any_of(pending_reservations_.begin(), pending_reservations_.end(),
+                       [&](auto&& reservation) {
+                         return InBuffer(reservation.begin, buffer, buffer_size_);
+                       });
+  }
+
+  // Hand the records in [begin, end) to the client, then call 'completion' if not null. The
+  // consumer mutex is released while the records are processed, and producers may queue more
+  // operations meanwhile. The buffer the records are in cannot be reclaimed by the overflow policy
+  // until they are processed.
+  void DeliverRecords(std::unique_lock<std::mutex>& consumer_lock, const std::byte* begin,
+                      const std::byte* end, void (*completion)(void*) = nullptr,
+                      void* completion_arg = nullptr) {
+    consumer_busy_ptr_ = begin;
+    consumer_lock.unlock();
+    uint64_t callback_ns = 0;
+    if (begin != end) {
+      const auto start = std::chrono::steady_clock::now();
+      if (shared_ring_)
+        PublishRecords(begin, end);
+      else
+        properties_.buffer_callback_fun(reinterpret_cast<const char*>(begin),
+                                        reinterpret_cast<const char*>(end),
+                                        properties_.buffer_callback_arg);
+      callback_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    }
+    if (completion != nullptr) completion(completion_arg);
+    consumer_lock.lock();
+    consumer_busy_ptr_ = nullptr;
+
+    if (begin != end) {
+      ++callbacks_;
+      callback_ns_ += callback_ns;
+      max_callback_ns_ = std::max(max_callback_ns_, callback_ns);
+    }
+  }
 
-    consumer_arg_.begin = data_begin;
-    consumer_arg_.end = data_end;
+  // Queue the records in [data_begin, data_end) for the consumer thread. If 'release' is not
+  // null, the buffer it points to is returned to its free list once the records are processed. If
+  // 'completion' is not null, it is called with 'completion_arg' once the records are processed.
+  // Return the ticket of the queued operation, tickets are numbered in queue order starting at 1.
+  uint64_t NotifyConsumerThread(const std::byte* data_begin, const std::byte* data_end,
+                                std::byte* release = nullptr,
+                                void (*completion)(void*) = nullptr,
+                                void* completion_arg = nullptr) {
+    uint64_t ticket;
+    {
+      std::lock_guard consumer_lock(consumer_mutex_);
+
+      // The queue is not bounded, but every full buffer queued holds one of the pool or lane
+      // buffers which are limited in number, and partially filled buffers are only queued by
+      // flushes.
+      consumer_queue_.push_back({data_begin, data_end, release, completion, completion_arg});
+      ticket = ++queued_ticket_;
+
+      if (release != nullptr)
+        ++buffer_switches_;
+      else if (data_begin != data_end)
+        ++flushes_;
+      queued_bytes_ += data_end - data_begin;
+      max_queued_bytes_ = std::max(max_queued_bytes_, queued_bytes_);
+    }
 
-    consumer_arg_.valid = true;
-    consumer_cond_.notify_all();
+    ConsumerExecutor::Instance().Schedule(*this);
+    return ticket;
+  }
+
+  // Wait until the operation with the given ticket, and all operations queued before it, are
+  // processed by the consumer thread.
+  void WaitForConsumerThread(uint64_t ticket) {
+    std::unique_lock consumer_lock(consumer_mutex_);
+    ProducerWait(consumer_lock, [this, ticket]() { return completed_ticket_ >= ticket; });
+  }
+
+  // Wait until 'predicate' is true, adding the time spent waiting to the producer wait time. Must
+  // be called with the consumer mutex held.
+  template <typename Predicate>
+  void ProducerWait(std::unique_lock<std::mutex>& consumer_lock, Predicate&& predicate) {
+    if (predicate()) return;
+    const auto start = std::chrono::steady_clock::now();
+    consumer_cond_.wait(consumer_lock, std::forward<Predicate>(predicate));
+    producer_wait_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
   }
 
   void AllocateMemory(std::byte** ptr, size_t size) const {
+    if (page_allocator_) {
+      assert(*ptr == nullptr && "the page allocator cannot reallocate memory");
+      *ptr = page_allocator_->Allocate(size);
+      return;
+    }
+
     if (properties_.alloc_fun != nullptr) {
       // Use the custom allocator provided in the properties.
       properties_.alloc_fun(reinterpret_cast<char**>(ptr), size, properties_.alloc_arg);
@@ -209,25 +1186,106 @@ class MemoryPool {
     }
   }
 
+  // Free the memory allocated by AllocateMemory(&ptr, size).
+  void FreeMemory(std::byte* ptr, size_t size) const {
+    if (page_allocator_) return page_allocator_->Free(ptr, size);
+    AllocateMemory(&ptr, 0);
+  }
+
   // Properties used to create the memory pool.
   const roctracer_properties_t properties_;
+  const bool per_thread_buffers_;
+  const bool compact_records_;
+  const uint64_t time_base_ns_;
+  const size_t buffer_size_;
+  const size_t buffer_count_;
+  const roctracer_pool_overflow_policy_t overflow_policy_;
+  std::optional<PageAllocator> page_allocator_;
+
+  // Shared memory mode: the ring the records are published to, and the chunk being published,
+  // only accessed by the consumer thread. With the blocking overflow policy, the records are
+  // dropped if the reader did not free space in the ring after kSharedMemoryWaitTimeout.
+  static constexpr std::chrono::seconds kSharedMemoryWaitTimeout{1};
+  std::unique_ptr<SharedMemoryRing> shared_ring_;
+  std::vector<std::byte> publish_buffer_;
+
+  // The interned strings already defined in this pool, one bit per string ID. Strings with larger
+  // IDs are defined every time they are used.
+  static constexpr uint32_t kMaxDefinedStrings = 64 * 1024;
+  std::array<std::atomic<uint64_t>, kMaxDefinedStrings / 64> defined_strings_{};
+
+  // Records dropped by the overflow policy, in total and since the last records lost markers.
+  std::array<std::atomic<uint64_t>, ACTIVITY_DOMAIN_NUMBER> records_lost_{};
+  std::array<std::atomic<uint64_t>, ACTIVITY_DOMAIN_NUMBER> records_lost_marker_{};
+  std::atomic<bool> records_lost_pending_{false};
+
+  // Unique pool ID used to find the calling thread's lane. IDs are never reused, so a stale lane
+  // left in a thread's lane list can never be mistaken for a lane of a new pool.
+  static inline std::atomic<uint64_t> next_id_{1};
+  const uint64_t id_{next_id_.fetch_add(1, std::memory_order_relaxed)};
 
   // Pool definition
   std::byte* pool_begin_;
-  std::byte* pool_end_;
   std::byte* buffer_begin_;
   std::byte* buffer_end_;
   std::byte* record_ptr_;
+  std::byte* submitted_ptr_;  // The records before this pointer are queued for the consumer.
   std::byte* data_ptr_;
+  std::byte* reserved_end_{nullptr};  // The end of the reserved records, see Reserve().
+  uint64_t records_written_{0};  // Records written to the pool buffers.
+  uint64_t bytes_written_{0};
   std::mutex producer_mutex_;
 
-  // Consumer thread
-  std::thread consumer_thread_;
-  struct {
+  // Per-thread buffers
+  std::vector<std::shared_ptr<Lane>> lanes_;
+  uint64_t retired_records_written_{0};  // Records written to the lanes of exited threads.
+  uint64_t retired_bytes_written_{0};
+  std::mutex lanes_mutex_;
+
+  // Consumer, run by the consumer executor.
+  struct ConsumerArg {
     const std::byte* begin;
     const std::byte* end;
-    bool valid = false;
-  } consumer_arg_;
+    std::byte* release;  // The buffer to return to its free list once processed.
+    void (*completion)(void*);  // The function to call once processed.
+    void* completion_arg;
+  };
+  std::deque<ConsumerArg> consumer_queue_;
+  const std::byte* consumer_busy_ptr_{nullptr};  // The records being processed.
+
+  // The reservations made with ReservePending() and not yet delivered.
+  std::vector<PendingReservation> pending_reservations_;
+  std::vector<std::byte*> held_buffers_;  // Processed buffers holding a skipped reservation.
+  uint64_t queued_ticket_{0};     // The ticket of the last queued operation.
+  uint64_t completed_ticket_{0};  // The ticket of the last processed operation.
+
+  // The free lists are protected by the consumer mutex, as buffers are released by the consumer
+  // thread.
+  std::deque<std::byte*> free_buffers_;        // The pool buffers not in use or queued.
+  std::vector<std::byte*> lane_buffers_;       // All the lane buffers allocated by this pool.
+  std::vector<std::byte*> free_lane_buffers_;  // The lane buffers not assigned to any lane.
+  size_t lane_count_{0};
+
+  // Spill arena, protected by the consumer mutex. The data too large to fit in a buffer is copied
+  // to spill blocks attached to the buffer holding the record, and recycled when the buffer is
+  // released.
+  struct Spill {
+    std::byte* data;
+    size_t size;
+  };
+  std::unordered_map<const std::byte*, std::vector<Spill>> buffer_spills_;
+  std::vector<Spill> free_spills_;
+  size_t free_spill_size_{0};
+
+  // Statistics, protected by the consumer mutex.
+  uint64_t producer_wait_ns_{0};
+  uint64_t flushes_{0};
+  uint64_t buffer_switches_{0};
+  uint64_t callbacks_{0};
+  uint64_t callback_ns_{0};
+  uint64_t max_callback_ns_{0};
+  uint64_t queued_bytes_{0};
+  uint64_t max_queued_bytes_{0};
 
   std::mutex consumer_mutex_;
   std::condition_variable consumer_cond_;
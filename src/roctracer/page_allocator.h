@@ -0,0 +1,128 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+#ifndef PAGE_ALLOCATOR_H_
+#define PAGE_ALLOCATOR_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace roctracer {
+
+// Allocates page-backed memory directly from the kernel with mmap. The memory can be backed by
+// huge pages, to reduce the TLB misses when writing records to large buffers, and bound to a NUMA
+// node. The pages are faulted in when allocated so that the first writes to a buffer do not take
+// page faults.
+class PageAllocator {
+ public:
+  static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+  static constexpr int kNoNumaNode = -1;
+
+  // 'numa_node' is the node to bind the memory to, or kNoNumaNode to use the default policy of
+  // the calling thread.
+  PageAllocator(bool huge_pages, int numa_node) : huge_pages_(huge_pages), numa_node_(numa_node) {}
+
+  // Return the NUMA node of the CPU the calling thread is running on, or 0 if it is unknown.
+  static int CurrentNumaNode() {
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+    return static_cast<int>(node);
+  }
+
+  // Allocate 'size' bytes. Return nullptr if the memory could not be allocated.
+  std::byte* Allocate(size_t size) const {
+    const size_t length = MappingLength(size);
+    void* ptr = MAP_FAILED;
+
+    // Try explicit huge pages first, they are only available if the administrator reserved some.
+    // The mapping fails if not enough huge pages are free.
+    bool explicit_huge_pages = false;
+    if (huge_pages_) {
+      ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                 -1, 0);
+      explicit_huge_pages = ptr != MAP_FAILED;
+    }
+
+    if (ptr == MAP_FAILED && huge_pages_) {
+      // Fall back to transparent huge pages. The kernel can only back the mapping with huge pages
+      // if it is aligned on a huge page boundary, so map more than needed and trim the excess.
+      void* mapping = mmap(nullptr, length + kHugePageSize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mapping == MAP_FAILED) return nullptr;
+
+      auto begin = reinterpret_cast<uintptr_t>(mapping);
+      auto aligned = (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+      if (aligned != begin) munmap(mapping, aligned - begin);
+      if (size_t tail = kHugePageSize - (aligned - begin); tail != 0)
+        munmap(reinterpret_cast<void*>(aligned + length), tail);
+
+      ptr = reinterpret_cast<void*>(aligned);
+      madvise(ptr, length, MADV_HUGEPAGE);
+    } else if (ptr == MAP_FAILED) {
+      ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (ptr == MAP_FAILED) return nullptr;
+    }
+
+    // Bind the pages before they are faulted in, so that they are allocated on the NUMA node. A
+    // binding failure, for example on a system without NUMA support, is not fatal. The huge pages
+    // reserved for the mapping may be on another node, so explicit huge pages only prefer the node
+    // instead of faulting if it has no free huge pages.
+    if (numa_node_ != kNoNumaNode) {
+      constexpr int kMpolPreferred = 1, kMpolBind = 2;  // From <numaif.h>.
+      std::array<unsigned long, 16> node_mask{};
+      constexpr size_t kBitsPerMask = sizeof(node_mask[0]) * 8;
+      if (static_cast<size_t>(numa_node_) < node_mask.size() * kBitsPerMask) {
+        node_mask[numa_node_ / kBitsPerMask] = 1UL << (numa_node_ % kBitsPerMask);
+        syscall(SYS_mbind, ptr, length, explicit_huge_pages ? kMpolPreferred : kMpolBind,
+                node_mask.data(), node_mask.size() * kBitsPerMask + 1, 0);
+      }
+    }
+
+    // Fault the pages in by touching each of them.
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < length; offset += page_size)
+      static_cast<volatile std::byte*>(ptr)[offset] = std::byte{0};
+
+    return static_cast<std::byte*>(ptr);
+  }
+
+  // Free memory returned by Allocate(size).
+  void Free(std::byte* ptr, size_t size) const {
+    if (ptr != nullptr) munmap(ptr, MappingLength(size));
+  }
+
+ private:
+  size_t MappingLength(size_t size) const {
+    const size_t alignment = huge_pages_ ? kHugePageSize : sysconf(_SC_PAGESIZE);
+    return (size + alignment - 1) & ~(alignment - 1);
+  }
+
+  const bool huge_pages_;
+  const int numa_node_;
+};
+
+}  // namespace roctracer
+
+#endif  // PAGE_ALLOCATOR_H_
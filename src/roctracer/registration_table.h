@@ -23,12 +23,15 @@
 
 #include "ext/prof_protocol.h"
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cassert>
+#include <forward_list>
+#include <mutex>
 #include <optional>
-#include <shared_mutex>
 #include <utility>
+#include <vector>
 
 namespace roctracer::util {
 
@@ -51,46 +54,110 @@ struct False {
 };
 }  // namespace detail
 
-// Generic callbacks table
+// Generic callbacks table.
+//
+// The table is an immutable snapshot mapping each operation ID to a pointer to an immutable entry,
+// or to null if the operation is not registered. Get only does acquire loads of the snapshot
+// pointer and of the entry, so lookups from the traced API calls never write to a shared cache
+// line. Register/Unregister are serialized by a table mutex. They copy the published snapshot,
+// update the copy, and publish it with a single release store, so that a reader sees all the
+// operations of a bulk registration or none of them.
+//
+// Since a reader may still be using a snapshot or an entry after it was replaced, snapshots and
+// entries are never freed while the table is alive. Instead, they are kept and reused when an
+// equal one is published again. The memory retained is then bounded by the number of distinct
+// values (callback/argument pairs, or memory pools) and of distinct sets of registered operations,
+// not by the number of Register calls.
 template <typename T, uint32_t N, typename IsStopped = detail::False> class RegistrationTable {
  public:
-  struct table_element_t {
-    std::atomic<bool> enabled{false};
-    mutable std::shared_mutex mutex;
-    T data;
-  };
-
   template <typename... Args> void Register(uint32_t operation_id, Args... args) {
     assert(operation_id < N && "operation_id is out of range");
-    table_element_t& entry = table_.at(operation_id);
-    std::unique_lock lock(entry.mutex);
-    if (!entry.enabled.exchange(true, std::memory_order_relaxed))
-      registered_count_.fetch_add(1, std::memory_order_relaxed);
-    entry.data = T{std::forward<Args>(args)...};
+    std::lock_guard lock(mutex_);
+    const T* data = Intern(T{std::forward<Args>(args)...});
+    Update([&](auto& entries) { entries.at(operation_id) = data; });
   }
 
   void Unregister(uint32_t operation_id) {
     assert(operation_id < N && "id is out of range");
-    table_element_t& entry = table_.at(operation_id);
-    std::unique_lock lock(entry.mutex);
-    if (entry.enabled.exchange(false, std::memory_order_relaxed))
-      registered_count_.fetch_sub(1, std::memory_order_relaxed);
+    std::lock_guard lock(mutex_);
+    Update([&](auto& entries) { entries.at(operation_id) = nullptr; });
+  }
+
+  // Register the same data for all the operations of 'operation_ids', in a single snapshot.
+  template <typename... Args>
+  void Register(const std::vector<uint32_t>& operation_ids, Args... args) {
+    std::lock_guard lock(mutex_);
+    const T* data = Intern(T{std::forward<Args>(args)...});
+    Update([&](auto& entries) {
+      for (uint32_t operation_id : operation_ids) {
+        assert(operation_id < N && "operation_id is out of range");
+        entries.at(operation_id) = data;
+      }
+    });
+  }
+
+  void Unregister(const std::vector<uint32_t>& operation_ids) {
+    std::lock_guard lock(mutex_);
+    Update([&](auto& entries) {
+      for (uint32_t operation_id : operation_ids) {
+        assert(operation_id < N && "id is out of range");
+        entries.at(operation_id) = nullptr;
+      }
+    });
   }
 
   std::optional<T> Get(uint32_t operation_id) const {
     assert(operation_id < N && "id is out of range");
-    const table_element_t& entry = table_.at(operation_id);
-    if (!entry.enabled.load(std::memory_order_relaxed) || IsStopped{}()) return std::nullopt;
-    std::shared_lock lock(entry.mutex);
-    return entry.enabled.load(std::memory_order_relaxed) ? std::make_optional(entry.data)
-                                                         : std::nullopt;
+    const Snapshot* snapshot = snapshot_.load(std::memory_order_acquire);
+    if (snapshot == nullptr) return std::nullopt;
+    const T* data = snapshot->entries.at(operation_id);
+    if (data == nullptr || IsStopped{}()) return std::nullopt;
+    return *data;
   }
 
-  bool IsEmpty() const { return registered_count_.load(std::memory_order_relaxed) == 0; }
+  bool IsEmpty() const {
+    const Snapshot* snapshot = snapshot_.load(std::memory_order_acquire);
+    return snapshot == nullptr || snapshot->registered_count == 0;
+  }
 
  private:
-  std::atomic<size_t> registered_count_{0};
-  std::array<table_element_t, N> table_{};
+  struct Snapshot {
+    std::array<const T*, N> entries{};
+    size_t registered_count{0};
+  };
+
+  // Return the retained entry equal to 'data', creating it if there is none. Must be called with
+  // the mutex held.
+  const T* Intern(T data) {
+    for (const T& entry : entries_)
+      if (entry == data) return &entry;
+    return &entries_.emplace_front(std::move(data));
+  }
+
+  // Copy the published snapshot, let 'update' modify the entries of the copy, and publish the
+  // retained snapshot equal to the copy, creating it if there is none. Must be called with the
+  // mutex held.
+  template <typename Function> void Update(Function&& update) {
+    const Snapshot* current = snapshot_.load(std::memory_order_relaxed);
+    Snapshot snapshot = current != nullptr ? *current : Snapshot{};
+    update(snapshot.entries);
+    snapshot.registered_count =
+        N - std::count(snapshot.entries.begin(), snapshot.entries.end(), nullptr);
+
+    const Snapshot* published = nullptr;
+    for (const Snapshot& retained : snapshots_) {
+      if (retained.entries != snapshot.entries) continue;
+      published = &retained;
+      break;
+    }
+    if (published == nullptr) published = &snapshots_.emplace_front(snapshot);
+    snapshot_.store(published, std::memory_order_release);
+  }
+
+  std::mutex mutex_;
+  std::forward_list<T> entries_;
+  std::forward_list<Snapshot> snapshots_;
+  std::atomic<const Snapshot*> snapshot_{nullptr};  // Null if no operation was ever registered.
 };
 
 #if IGNORE_GCC_ARRAY_BOUNDS_ERROR
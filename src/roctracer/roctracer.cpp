@@ -31,13 +31,16 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <mutex>
+#include <numeric>
 #include <stack>
 #include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#include "compact_record.h"
 #include "correlation_id.h"
 #include "debug.h"
 #include "exception.h"
@@ -46,6 +49,7 @@
 #include "logger.h"
 #include "memory_pool.h"
 #include "registration_table.h"
+#include "string_table.h"
 
 #define API_METHOD_PREFIX                                                                          \
   roctracer_status_t err = ROCTRACER_STATUS_SUCCESS;                                               \
@@ -97,6 +101,12 @@ std::mutex registration_mutex;
 std::recursive_mutex memory_pool_mutex;
 MemoryPool* default_memory_pool = nullptr;
 
+// Run the pending consumer work and join the consumer threads when the library is unloaded, so
+// that no thread is left running its code.
+struct ConsumerExecutorFinalizer {
+  ~ConsumerExecutorFinalizer() { ConsumerExecutor::Instance().Shutdown(); }
+} consumer_executor_finalizer;
+
 }  // namespace
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -286,27 +296,29 @@ template <activity_domain_t domain> struct ApiTracer {
   static void Exit(OperationId operation_id, TraceData* trace_data) {
     if (auto pool = activity_table.Get(operation_id)) {
       assert(trace_data != nullptr);
-      activity_record_t record{};
-
-      record.domain = domain;
-      record.op = operation_id;
-      record.correlation_id = trace_data->api_data.correlation_id;
-      record.begin_ns = trace_data->phase_enter_timestamp;
-      record.end_ns = hsa_support::timestamp_ns();
-      record.process_id = GetPid();
-      record.thread_id = GetTid();
-
-      if (auto external_id = ExternalCorrelationId()) {
-        roctracer_record_t ext_record{};
-        ext_record.domain = ACTIVITY_DOMAIN_EXT_API;
-        ext_record.op = ACTIVITY_EXT_OP_EXTERN_ID;
-        ext_record.correlation_id = record.correlation_id;
-        ext_record.external_id = *external_id;
-        // Write the external correlation id record directly followed by the activity record.
-        (*pool)->Write(std::array<roctracer_record_t, 2>{ext_record, record});
-      } else {
-        // Write record to the buffer.
-        (*pool)->Write(record);
+      const uint64_t end_ns = hsa_support::timestamp_ns();
+      const auto external_id = ExternalCorrelationId();
+
+      // Reserve the records in the pool and fill them in place. The external correlation id
+      // record, if any, is directly followed by the activity record.
+      if (roctracer_record_t* records = (*pool)->Reserve(domain, external_id ? 2 : 1)) {
+        activity_record_t* record = records;
+        if (external_id) {
+          record->domain = ACTIVITY_DOMAIN_EXT_API;
+          record->op = ACTIVITY_EXT_OP_EXTERN_ID;
+          record->correlation_id = trace_data->api_data.correlation_id;
+          record->external_id = *external_id;
+          ++record;
+        }
+
+        record->domain = domain;
+        record->op = operation_id;
+        record->correlation_id = trace_data->api_data.correlation_id;
+        record->begin_ns = trace_data->phase_enter_timestamp;
+        record->end_ns = end_ns;
+        record->process_id = GetPid();
+        record->thread_id = GetTid();
+        (*pool)->Commit(records);
       }
     }
     CorrelationIdPop();
@@ -385,17 +397,21 @@ int TracerCallback(activity_domain_t domain, uint32_t operation_id, void* data)
 
     case ACTIVITY_DOMAIN_HIP_OPS:
       if (auto pool = hip_ops_activity_table.Get(operation_id)) {
-        if (auto record = static_cast<activity_record_t*>(data)) {
-          // If the record is for a kernel dispatch, write the kernel name in the pool's data,
-          // and make the record point to it. Older HIP runtimes do not provide a kernel
+        if (auto data_record = static_cast<const activity_record_t*>(data)) {
+          // The record belongs to the HIP runtime, so rewrite a copy. If the record is for a
+          // kernel dispatch, make the copy point to the interned kernel name, and define the name
+          // in the pool the first time it is used. Older HIP runtimes do not provide a kernel
           // name, so record.kernel_name might be null.
-          if (operation_id == HIP_OP_ID_DISPATCH && record->kernel_name != nullptr)
-            (*pool)->Write(*record, record->kernel_name, strlen(record->kernel_name) + 1,
-                           [](auto& record, const void* data) {
-                             record.kernel_name = static_cast<const char*>(data);
-                           });
-          else
-            (*pool)->Write(*record);
+          activity_record_t record = *data_record;
+          record.string_id = StringTable::kNoStringId;
+          if (operation_id == HIP_OP_ID_DISPATCH && record.kernel_name != nullptr) {
+            auto [kernel_name, string_id] =
+                StringTable::Instance().InternCached(record.kernel_name);
+            (*pool)->DefineString(string_id, kernel_name);
+            record.kernel_name = kernel_name;
+            record.string_id = string_id;
+          }
+          (*pool)->Write(record);
         }
         return 0;
       }
@@ -445,14 +461,19 @@ template <typename... Tables> struct RegistrationTableGroup {
         disengage_tracer_(std::forward<Functor2>(disengage_tracer)),
         tables_(tables...) {}
 
+  // Register or unregister all the operations of 'operation_ids' in one step: the tracer is
+  // engaged or disengaged at most once, not once per operation.
   template <typename T, typename... Args>
-  void Register(T& table, uint32_t operation_id, Args... args) const {
+  void Register(T& table, const std::vector<uint32_t>& operation_ids, Args... args) const {
+    if (operation_ids.empty()) return;
     if (AllEmpty()) engage_tracer_();
-    table.Register(operation_id, std::forward<Args>(args)...);
+    table.Register(operation_ids, std::forward<Args>(args)...);
   }
 
-  template <typename T> void Unregister(T& table, uint32_t operation_id) const {
-    table.Unregister(operation_id);
+  template <typename T>
+  void Unregister(T& table, const std::vector<uint32_t>& operation_ids) const {
+    if (operation_ids.empty()) return;
+    table.Unregister(operation_ids);
     if (AllEmpty()) disengage_tracer_();
   }
 
@@ -475,36 +496,58 @@ RegistrationTableGroup ROCTX_registration_group(
     []() { RocTxLoader::Instance().RegisterTracerCallback(TracerCallback); },
     []() { RocTxLoader::Instance().RegisterTracerCallback(nullptr); }, roctx_api_callback_table);
 
+// Return all the operation IDs of 'domain'.
+std::vector<uint32_t> DomainOperationIds(activity_domain_t domain) {
+  std::vector<uint32_t> operation_ids(get_op_end(domain) - get_op_begin(domain));
+  std::iota(operation_ids.begin(), operation_ids.end(), get_op_begin(domain));
+  return operation_ids;
+}
+
+// Return the operation IDs of the 'op_count' long list 'ops'.
+std::vector<uint32_t> OperationIds(const uint32_t* ops, uint32_t op_count) {
+  if (ops == nullptr && op_count != 0)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+  return std::vector<uint32_t>(ops, ops + op_count);
+}
+
+// Return true if all the operation IDs are valid for 'domain'.
+bool ValidOperationIds(activity_domain_t domain, const std::vector<uint32_t>& operation_ids) {
+  const uint32_t op_end = get_op_end(domain);
+  return std::all_of(operation_ids.begin(), operation_ids.end(),
+                     [op_end](uint32_t operation_id) { return operation_id < op_end; });
+}
+
 }  // namespace
 
 // Enable runtime API callbacks
-static void roctracer_enable_callback_impl(roctracer_domain_t domain, uint32_t operation_id,
+static void roctracer_enable_callback_impl(roctracer_domain_t domain,
+                                           const std::vector<uint32_t>& operation_ids,
                                            roctracer_rtapi_callback_t callback, void* user_data) {
   std::lock_guard lock(registration_mutex);
 
-  if (operation_id >= get_op_end(domain) || callback == nullptr)
+  if (!ValidOperationIds(domain, operation_ids) || callback == nullptr)
     throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
 
   switch (domain) {
     case ACTIVITY_DOMAIN_HSA_EVT:
-      HSA_registration_group.Register(hsa_evt_callback_table, operation_id, callback, user_data);
+      HSA_registration_group.Register(hsa_evt_callback_table, operation_ids, callback, user_data);
       break;
     case ACTIVITY_DOMAIN_HSA_API:
-      HSA_registration_group.Register(HSA_ApiTracer::callback_table, operation_id, callback,
+      HSA_registration_group.Register(HSA_ApiTracer::callback_table, operation_ids, callback,
                                       user_data);
       break;
     case ACTIVITY_DOMAIN_HSA_OPS:
       break;
     case ACTIVITY_DOMAIN_HIP_API:
       if (HipLoader::Instance().IsEnabled())
-        HIP_registration_group.Register(HIP_ApiTracer::callback_table, operation_id, callback,
+        HIP_registration_group.Register(HIP_ApiTracer::callback_table, operation_ids, callback,
                                         user_data);
       break;
     case ACTIVITY_DOMAIN_HIP_OPS:
       break;
     case ACTIVITY_DOMAIN_ROCTX:
       if (RocTxLoader::Instance().IsEnabled())
-        ROCTX_registration_group.Register(roctx_api_callback_table, operation_id, callback,
+        ROCTX_registration_group.Register(roctx_api_callback_table, operation_ids, callback,
                                           user_data);
       break;
     default:
@@ -517,44 +560,53 @@ ROCTRACER_API roctracer_status_t roctracer_enable_op_callback(roctracer_domain_t
                                                               roctracer_rtapi_callback_t callback,
                                                               void* user_data) {
   API_METHOD_PREFIX
-  roctracer_enable_callback_impl(domain, op, callback, user_data);
+  roctracer_enable_callback_impl(domain, {op}, callback, user_data);
   API_METHOD_SUFFIX
 }
 
 ROCTRACER_API roctracer_status_t roctracer_enable_domain_callback(
     roctracer_domain_t domain, roctracer_rtapi_callback_t callback, void* user_data) {
   API_METHOD_PREFIX
-  const uint32_t op_end = get_op_end(domain);
-  for (uint32_t op = get_op_begin(domain); op < op_end; ++op)
-    roctracer_enable_callback_impl(domain, op, callback, user_data);
+  roctracer_enable_callback_impl(domain, DomainOperationIds(domain), callback, user_data);
+  API_METHOD_SUFFIX
+}
+
+ROCTRACER_API roctracer_status_t roctracer_enable_ops_callback(roctracer_domain_t domain,
+                                                               const uint32_t* ops,
+                                                               uint32_t op_count,
+                                                               roctracer_rtapi_callback_t callback,
+                                                               void* user_data) {
+  API_METHOD_PREFIX
+  roctracer_enable_callback_impl(domain, OperationIds(ops, op_count), callback, user_data);
   API_METHOD_SUFFIX
 }
 
 // Disable runtime API callbacks
-static void roctracer_disable_callback_impl(roctracer_domain_t domain, uint32_t operation_id) {
+static void roctracer_disable_callback_impl(roctracer_domain_t domain,
+                                            const std::vector<uint32_t>& operation_ids) {
   std::lock_guard lock(registration_mutex);
 
-  if (operation_id >= get_op_end(domain))
+  if (!ValidOperationIds(domain, operation_ids))
     throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
 
   switch (domain) {
     case ACTIVITY_DOMAIN_HSA_EVT:
-      HSA_registration_group.Unregister(hsa_evt_callback_table, operation_id);
+      HSA_registration_group.Unregister(hsa_evt_callback_table, operation_ids);
       break;
     case ACTIVITY_DOMAIN_HSA_API:
-      HSA_registration_group.Unregister(HSA_ApiTracer::callback_table, operation_id);
+      HSA_registration_group.Unregister(HSA_ApiTracer::callback_table, operation_ids);
       break;
     case ACTIVITY_DOMAIN_HSA_OPS:
       break;
     case ACTIVITY_DOMAIN_HIP_API:
       if (HipLoader::Instance().IsEnabled())
-        HIP_registration_group.Unregister(HIP_ApiTracer::callback_table, operation_id);
+        HIP_registration_group.Unregister(HIP_ApiTracer::callback_table, operation_ids);
       break;
     case ACTIVITY_DOMAIN_HIP_OPS:
       break;
     case ACTIVITY_DOMAIN_ROCTX:
       if (RocTxLoader::Instance().IsEnabled())
-        ROCTX_registration_group.Unregister(roctx_api_callback_table, operation_id);
+        ROCTX_registration_group.Unregister(roctx_api_callback_table, operation_ids);
       break;
     default:
       EXC_RAISING(ROCTRACER_STATUS_ERROR_INVALID_DOMAIN_ID, "invalid domain ID(" << domain << ")");
@@ -564,15 +616,21 @@ static void roctracer_disable_callback_impl(roctracer_domain_t domain, uint32_t
 ROCTRACER_API roctracer_status_t roctracer_disable_op_callback(roctracer_domain_t domain,
                                                                uint32_t op) {
   API_METHOD_PREFIX
-  roctracer_disable_callback_impl(domain, op);
+  roctracer_disable_callback_impl(domain, {op});
   API_METHOD_SUFFIX
 }
 
 ROCTRACER_API roctracer_status_t roctracer_disable_domain_callback(roctracer_domain_t domain) {
   API_METHOD_PREFIX
-  const uint32_t op_end = get_op_end(domain);
-  for (uint32_t op = get_op_begin(domain); op < op_end; ++op)
-    roctracer_disable_callback_impl(domain, op);
+  roctracer_disable_callback_impl(domain, DomainOperationIds(domain));
+  API_METHOD_SUFFIX
+}
+
+ROCTRACER_API roctracer_status_t roctracer_disable_ops_callback(roctracer_domain_t domain,
+                                                                const uint32_t* ops,
+                                                                uint32_t op_count) {
+  API_METHOD_PREFIX
+  roctracer_disable_callback_impl(domain, OperationIds(ops, op_count));
   API_METHOD_SUFFIX
 }
 
@@ -589,6 +647,21 @@ ROCTRACER_API roctracer_pool_t* roctracer_default_pool() {
   return reinterpret_cast<roctracer_pool_t*>(default_memory_pool);
 }
 
+// Configure the consumer threads shared by all the memory pools
+ROCTRACER_API roctracer_status_t roctracer_configure_consumer_threads(uint32_t thread_count,
+                                                                      const uint32_t* cpus,
+                                                                      uint32_t cpu_count) {
+  API_METHOD_PREFIX
+  std::vector<uint32_t> cpu_list;
+  if (cpus != nullptr) cpu_list.assign(cpus, cpus + cpu_count);
+  if (!ConsumerExecutor::Instance().Configure(thread_count == ROCTRACER_CONSUMER_THREADS_PER_POOL
+                                                  ? ConsumerExecutor::kThreadPerTask
+                                                  : thread_count,
+                                              std::move(cpu_list)))
+    EXC_RAISING(ROCTRACER_STATUS_ERROR, "consumer threads already started");
+  API_METHOD_SUFFIX
+}
+
 // Open memory pool
 static void roctracer_open_pool_impl(const roctracer_properties_t* properties,
                                      roctracer_pool_t** pool) {
@@ -624,8 +697,26 @@ ROCTRACER_API roctracer_status_t roctracer_next_record(const activity_record_t*
   API_METHOD_SUFFIX
 }
 
+// Decode the next compact activity record
+ROCTRACER_API roctracer_status_t roctracer_next_compact_record(const char** record,
+                                                               const char* end,
+                                                               uint64_t time_base_ns,
+                                                               activity_record_t* decoded) {
+  API_METHOD_PREFIX
+  if (record == nullptr || *record == nullptr || decoded == nullptr || *record >= end)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+
+  auto next =
+      compact_record::Decode(reinterpret_cast<const std::byte*>(*record),
+                             reinterpret_cast<const std::byte*>(end), time_base_ns, decoded);
+  if (next == nullptr) EXC_RAISING(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "truncated record");
+  *record = reinterpret_cast<const char*>(next);
+  API_METHOD_SUFFIX
+}
+
 // Enable activity records logging
-static void roctracer_enable_activity_impl(roctracer_domain_t domain, uint32_t op,
+static void roctracer_enable_activity_impl(roctracer_domain_t domain,
+                                           const std::vector<uint32_t>& operation_ids,
                                            roctracer_pool_t* pool) {
   std::lock_guard lock(registration_mutex);
 
@@ -634,25 +725,25 @@ static void roctracer_enable_activity_impl(roctracer_domain_t domain, uint32_t o
   if (memory_pool == nullptr)
     EXC_RAISING(ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED, "no default pool");
 
-  if (op >= get_op_end(domain))
+  if (!ValidOperationIds(domain, operation_ids))
     throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
 
   switch (domain) {
     case ACTIVITY_DOMAIN_HSA_EVT:
       break;
     case ACTIVITY_DOMAIN_HSA_API:
-      HSA_registration_group.Register(HSA_ApiTracer::activity_table, op, memory_pool);
+      HSA_registration_group.Register(HSA_ApiTracer::activity_table, operation_ids, memory_pool);
       break;
     case ACTIVITY_DOMAIN_HSA_OPS:
-      HSA_registration_group.Register(hsa_ops_activity_table, op, memory_pool);
+      HSA_registration_group.Register(hsa_ops_activity_table, operation_ids, memory_pool);
       break;
     case ACTIVITY_DOMAIN_HIP_API:
       if (HipLoader::Instance().IsEnabled())
-        HIP_registration_group.Register(HIP_ApiTracer::activity_table, op, memory_pool);
+        HIP_registration_group.Register(HIP_ApiTracer::activity_table, operation_ids, memory_pool);
       break;
     case ACTIVITY_DOMAIN_HIP_OPS:
       if (HipLoader::Instance().IsEnabled())
-        HIP_registration_group.Register(hip_ops_activity_table, op, memory_pool);
+        HIP_registration_group.Register(hip_ops_activity_table, operation_ids, memory_pool);
       break;
     case ACTIVITY_DOMAIN_ROCTX:
       break;
@@ -665,25 +756,24 @@ ROCTRACER_API roctracer_status_t roctracer_enable_op_activity_expl(roctracer_dom
                                                                    uint32_t op,
                                                                    roctracer_pool_t* pool) {
   API_METHOD_PREFIX
-  roctracer_enable_activity_impl(domain, op, pool);
+  roctracer_enable_activity_impl(domain, {op}, pool);
   API_METHOD_SUFFIX
 }
 
 ROCTRACER_API roctracer_status_t roctracer_enable_op_activity(activity_domain_t domain,
                                                               uint32_t op) {
   API_METHOD_PREFIX
-  roctracer_enable_activity_impl(domain, op, nullptr);
+  roctracer_enable_activity_impl(domain, {op}, nullptr);
   API_METHOD_SUFFIX
 }
 
 static void roctracer_enable_domain_activity_impl(roctracer_domain_t domain,
                                                   roctracer_pool_t* pool) {
-  const uint32_t op_end = get_op_end(domain);
-  for (uint32_t op = get_op_begin(domain); op < op_end; ++op) try {
-      roctracer_enable_activity_impl(domain, op, pool);
-    } catch (const ApiError& err) {
-      if (err.status() != ROCTRACER_STATUS_ERROR_NOT_IMPLEMENTED) throw;
-    }
+  try {
+    roctracer_enable_activity_impl(domain, DomainOperationIds(domain), pool);
+  } catch (const ApiError& err) {
+    if (err.status() != ROCTRACER_STATUS_ERROR_NOT_IMPLEMENTED) throw;
+  }
 }
 
 ROCTRACER_API roctracer_status_t roctracer_enable_domain_activity_expl(roctracer_domain_t domain,
@@ -699,29 +789,39 @@ ROCTRACER_API roctracer_status_t roctracer_enable_domain_activity(activity_domai
   API_METHOD_SUFFIX
 }
 
+ROCTRACER_API roctracer_status_t roctracer_enable_ops_activity_expl(roctracer_domain_t domain,
+                                                                    const uint32_t* ops,
+                                                                    uint32_t op_count,
+                                                                    roctracer_pool_t* pool) {
+  API_METHOD_PREFIX
+  roctracer_enable_activity_impl(domain, OperationIds(ops, op_count), pool);
+  API_METHOD_SUFFIX
+}
+
 // Disable activity records logging
-static void roctracer_disable_activity_impl(roctracer_domain_t domain, uint32_t op) {
+static void roctracer_disable_activity_impl(roctracer_domain_t domain,
+                                            const std::vector<uint32_t>& operation_ids) {
   std::lock_guard lock(registration_mutex);
 
-  if (op >= get_op_end(domain))
+  if (!ValidOperationIds(domain, operation_ids))
     throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
 
   switch (domain) {
     case ACTIVITY_DOMAIN_HSA_EVT:
       break;
     case ACTIVITY_DOMAIN_HSA_API:
-      HSA_registration_group.Unregister(HSA_ApiTracer::activity_table, op);
+      HSA_registration_group.Unregister(HSA_ApiTracer::activity_table, operation_ids);
       break;
     case ACTIVITY_DOMAIN_HSA_OPS:
-      HSA_registration_group.Unregister(hsa_ops_activity_table, op);
+      HSA_registration_group.Unregister(hsa_ops_activity_table, operation_ids);
       break;
     case ACTIVITY_DOMAIN_HIP_API:
       if (HipLoader::Instance().IsEnabled())
-        HIP_registration_group.Unregister(HIP_ApiTracer::activity_table, op);
+        HIP_registration_group.Unregister(HIP_ApiTracer::activity_table, operation_ids);
       break;
     case ACTIVITY_DOMAIN_HIP_OPS:
       if (HipLoader::Instance().IsEnabled())
-        HIP_registration_group.Unregister(hip_ops_activity_table, op);
+        HIP_registration_group.Unregister(hip_ops_activity_table, operation_ids);
       break;
     case ACTIVITY_DOMAIN_ROCTX:
       break;
@@ -733,17 +833,16 @@ static void roctracer_disable_activity_impl(roctracer_domain_t domain, uint32_t
 ROCTRACER_API roctracer_status_t roctracer_disable_op_activity(roctracer_domain_t domain,
                                                                uint32_t op) {
   API_METHOD_PREFIX
-  roctracer_disable_activity_impl(domain, op);
+  roctracer_disable_activity_impl(domain, {op});
   API_METHOD_SUFFIX
 }
 
 static void roctracer_disable_domain_activity_impl(roctracer_domain_t domain) {
-  const uint32_t op_end = get_op_end(domain);
-  for (uint32_t op = get_op_begin(domain); op < op_end; ++op) try {
-      roctracer_disable_activity_impl(domain, op);
-    } catch (const ApiError& err) {
-      if (err.status() != ROCTRACER_STATUS_ERROR_NOT_IMPLEMENTED) throw;
-    }
+  try {
+    roctracer_disable_activity_impl(domain, DomainOperationIds(domain));
+  } catch (const ApiError& err) {
+    if (err.status() != ROCTRACER_STATUS_ERROR_NOT_IMPLEMENTED) throw;
+  }
 }
 
 ROCTRACER_API roctracer_status_t roctracer_disable_domain_activity(roctracer_domain_t domain) {
@@ -752,6 +851,14 @@ ROCTRACER_API roctracer_status_t roctracer_disable_domain_activity(roctracer_dom
   API_METHOD_SUFFIX
 }
 
+ROCTRACER_API roctracer_status_t roctracer_disable_ops_activity(roctracer_domain_t domain,
+                                                                const uint32_t* ops,
+                                                                uint32_t op_count) {
+  API_METHOD_PREFIX
+  roctracer_disable_activity_impl(domain, OperationIds(ops, op_count));
+  API_METHOD_SUFFIX
+}
+
 // Close memory pool
 static void roctracer_close_pool_impl(roctracer_pool_t* pool) {
   std::lock_guard lock(memory_pool_mutex);
@@ -768,7 +875,7 @@ static void roctracer_close_pool_impl(roctracer_pool_t* pool) {
         if (pool == data.pool) ops.emplace_back(domain, op);
         return true;
       });
-  for (auto&& [domain, op] : ops) roctracer_disable_activity_impl(domain, op);
+  for (auto&& [domain, op] : ops) roctracer_disable_activity_impl(domain, {op});
 #endif
 
   delete (p);
@@ -805,6 +912,110 @@ ROCTRACER_API roctracer_status_t roctracer_flush_activity() {
   API_METHOD_SUFFIX
 }
 
+// Flush available activity records without waiting for them to be processed
+ROCTRACER_API roctracer_status_t roctracer_flush_activity_async(
+    roctracer_pool_t* pool, roctracer_flush_callback_t completion_cb, void* arg) {
+  API_METHOD_PREFIX
+  if (pool == nullptr) pool = roctracer_default_pool();
+  MemoryPool* memory_pool = reinterpret_cast<MemoryPool*>(pool);
+  if (memory_pool != nullptr)
+    memory_pool->FlushAsync(completion_cb, arg);
+  else if (completion_cb != nullptr)
+    completion_cb(arg);
+  API_METHOD_SUFFIX
+}
+
+// Return the number of records dropped by the pool's overflow policy
+ROCTRACER_API roctracer_status_t roctracer_pool_get_dropped_records(roctracer_pool_t* pool,
+                                                                    activity_domain_t domain,
+                                                                    uint64_t* count) {
+  API_METHOD_PREFIX
+  if (domain >= ACTIVITY_DOMAIN_NUMBER)
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_INVALID_DOMAIN_ID, "invalid domain ID(" << domain << ")");
+  if (count == nullptr)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+
+  if (pool == nullptr) pool = roctracer_default_pool();
+  MemoryPool* memory_pool = reinterpret_cast<MemoryPool*>(pool);
+  if (memory_pool == nullptr)
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED, "no default pool");
+
+  *count = memory_pool->RecordsLost(domain);
+  API_METHOD_SUFFIX
+}
+
+// Query the memory pool statistics
+ROCTRACER_API roctracer_status_t roctracer_pool_get_stats(roctracer_pool_t* pool,
+                                                          roctracer_pool_stats_t* stats) {
+  API_METHOD_PREFIX
+  if (stats == nullptr)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+
+  if (pool == nullptr) pool = roctracer_default_pool();
+  MemoryPool* memory_pool = reinterpret_cast<MemoryPool*>(pool);
+  if (memory_pool == nullptr)
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED, "no default pool");
+
+  *stats = memory_pool->GetStats();
+  API_METHOD_SUFFIX
+}
+
+// Reserve records in a memory pool, to be filled in place
+ROCTRACER_API roctracer_status_t roctracer_pool_reserve_records(roctracer_pool_t* pool,
+                                                                activity_domain_t domain,
+                                                                size_t count,
+                                                                roctracer_record_t** records) {
+  API_METHOD_PREFIX
+  if (domain >= ACTIVITY_DOMAIN_NUMBER)
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_INVALID_DOMAIN_ID, "invalid domain ID(" << domain << ")");
+  if (records == nullptr)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+
+  if (pool == nullptr) pool = roctracer_default_pool();
+  MemoryPool* memory_pool = reinterpret_cast<MemoryPool*>(pool);
+  if (memory_pool == nullptr)
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED, "no default pool");
+  if (count == 0 || count > memory_pool->MaxReservation())
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid record count(" << count << ")");
+
+  *records = memory_pool->ReservePending(domain, count);
+  API_METHOD_SUFFIX
+}
+
+// Commit the records reserved in a memory pool
+ROCTRACER_API roctracer_status_t roctracer_pool_commit_records(roctracer_pool_t* pool,
+                                                               roctracer_record_t* records) {
+  API_METHOD_PREFIX
+  if (records == nullptr)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+
+  if (pool == nullptr) pool = roctracer_default_pool();
+  MemoryPool* memory_pool = reinterpret_cast<MemoryPool*>(pool);
+  if (memory_pool == nullptr)
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED, "no default pool");
+
+  if (!memory_pool->CommitPending(records))
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "no pending reservation");
+  API_METHOD_SUFFIX
+}
+
+// Cancel the records reserved in a memory pool
+ROCTRACER_API roctracer_status_t roctracer_pool_cancel_records(roctracer_pool_t* pool,
+                                                               roctracer_record_t* records) {
+  API_METHOD_PREFIX
+  if (records == nullptr)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+
+  if (pool == nullptr) pool = roctracer_default_pool();
+  MemoryPool* memory_pool = reinterpret_cast<MemoryPool*>(pool);
+  if (memory_pool == nullptr)
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_DEFAULT_POOL_UNDEFINED, "no default pool");
+
+  if (!memory_pool->CancelPending(records))
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "no pending reservation");
+  API_METHOD_SUFFIX
+}
+
 // Notifies that the calling thread is entering an external API region.
 // Push an external correlation id for the calling thread.
 ROCTRACER_API roctracer_status_t
@@ -831,6 +1042,62 @@ roctracer_activity_pop_external_correlation_id(activity_correlation_id_t* last_i
   API_METHOD_SUFFIX
 }
 
+namespace {
+
+// The correlation ID of a context token carries this flag if the context has an external
+// correlation ID. The correlation IDs are allocated from 1 upwards and never reach it.
+constexpr uint64_t kContextHasExternalId = uint64_t{1} << 63;
+
+static_assert(sizeof(roctracer_correlation_context_t) == 16);
+
+roctracer_correlation_context_t EncodeCorrelationContext(const CorrelationContext& context) {
+  return {{context.correlation_id | (context.external_id ? kContextHasExternalId : 0),
+           context.external_id.value_or(0)}};
+}
+
+CorrelationContext DecodeCorrelationContext(const roctracer_correlation_context_t& token) {
+  CorrelationContext context{token.opaque[0] & ~kContextHasExternalId, std::nullopt};
+  if (token.opaque[0] & kContextHasExternalId) context.external_id = token.opaque[1];
+  return context;
+}
+
+}  // namespace
+
+// Capture the calling thread's correlation context, to be restored on another thread.
+ROCTRACER_API roctracer_status_t
+roctracer_correlation_context_capture(roctracer_correlation_context_t* context) {
+  API_METHOD_PREFIX
+  if (context == nullptr)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+
+  *context = EncodeCorrelationContext(CorrelationContextCapture());
+  API_METHOD_SUFFIX
+}
+
+// Enter a region of the calling thread running on behalf of a captured correlation context.
+ROCTRACER_API roctracer_status_t
+roctracer_correlation_context_restore(const roctracer_correlation_context_t* context) {
+  API_METHOD_PREFIX
+  if (context == nullptr)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+
+  CorrelationContextRestore(DecodeCorrelationContext(*context));
+  API_METHOD_SUFFIX
+}
+
+// Leave the region entered by roctracer_correlation_context_restore.
+ROCTRACER_API roctracer_status_t
+roctracer_correlation_context_release(const roctracer_correlation_context_t* context) {
+  API_METHOD_PREFIX
+  if (context == nullptr)
+    throw ApiError(ROCTRACER_STATUS_ERROR_INVALID_ARGUMENT, "invalid argument");
+
+  if (!CorrelationContextRelease(DecodeCorrelationContext(*context)))
+    EXC_RAISING(ROCTRACER_STATUS_ERROR_MISMATCHED_EXTERNAL_CORRELATION_ID,
+                "the correlation context is not the last one restored");
+  API_METHOD_SUFFIX
+}
+
 // Start API
 ROCTRACER_API void roctracer_start() {
   if (stopped_status.exchange(false, std::memory_order_relaxed) && roctracer_start_cb)
@@ -0,0 +1,239 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+#ifndef SHARED_MEMORY_RING_H_
+#define SHARED_MEMORY_RING_H_
+
+#include "ext/shm_protocol.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace roctracer {
+
+// A ring of chunks in a shared memory segment, written by a single writer and read by a single
+// reader, possibly in different processes. See ext/shm_protocol.h for the segment layout and the
+// publication protocol.
+class SharedMemoryRing {
+ public:
+  static constexpr size_t kHeaderSize = 4096;
+  static constexpr size_t kChunkHeaderSize = sizeof(uint64_t);
+  static_assert(sizeof(roctracer_shm_header_t) <= kHeaderSize);
+
+  // Create the segment file at 'path', replacing any existing file, with a ring of 'ring_size'
+  // bytes (a power of 2), and map it for writing. Throw std::system_error on failure.
+  SharedMemoryRing(const char* path, size_t ring_size, uint32_t flags, uint64_t time_base_ns) {
+    if ((ring_size & (ring_size - 1)) != 0 || ring_size < 2 * kChunkHeaderSize)
+      throw std::system_error(EINVAL, std::generic_category(), "invalid shared memory ring size");
+
+    const int fd = ::open(path, O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0600);
+    if (fd == -1) throw SystemError("cannot create", path);
+    Map(fd, kHeaderSize + ring_size, true);
+
+    header_->version = ROCTRACER_SHM_VERSION;
+    header_->flags = flags;
+    header_->header_size = kHeaderSize;
+    header_->ring_size = ring_size;
+    header_->time_base_ns = time_base_ns;
+    header_->writer_pid = static_cast<uint32_t>(::getpid());
+    ring_ = reinterpret_cast<std::byte*>(header_) + kHeaderSize;
+    ring_size_ = ring_size;
+
+    // A reader attaching to the segment sees an initialized header once the magic is set.
+    __atomic_store_n(&header_->magic, ROCTRACER_SHM_MAGIC, __ATOMIC_RELEASE);
+  }
+
+  // Attach to the segment file at 'path', created by a writer, for reading. Throw
+  // std::system_error on failure, or if the file is not a valid segment.
+  explicit SharedMemoryRing(const char* path) {
+    const int fd = ::open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1) throw SystemError("cannot open", path);
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1) {
+      const int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), "cannot stat segment");
+    }
+    if (static_cast<size_t>(st.st_size) < kHeaderSize) {
+      ::close(fd);
+      throw std::system_error(EINVAL, std::generic_category(), "not a shared memory segment");
+    }
+    Map(fd, st.st_size, false);
+
+    if (__atomic_load_n(&header_->magic, __ATOMIC_ACQUIRE) != ROCTRACER_SHM_MAGIC ||
+        header_->version != ROCTRACER_SHM_VERSION ||
+        header_->header_size + header_->ring_size > mapping_size_ ||
+        (header_->ring_size & (header_->ring_size - 1)) != 0) {
+      ::munmap(header_, mapping_size_);
+      throw std::system_error(EINVAL, std::generic_category(), "invalid shared memory segment");
+    }
+    ring_ = reinterpret_cast<std::byte*>(header_) + header_->header_size;
+    ring_size_ = header_->ring_size;
+  }
+
+  ~SharedMemoryRing() { ::munmap(header_, mapping_size_); }
+
+  SharedMemoryRing(const SharedMemoryRing&) = delete;
+  SharedMemoryRing& operator=(const SharedMemoryRing&) = delete;
+
+  // Writer: copy 'size' bytes to a new chunk and publish it. If the ring does not have enough free
+  // space, wait up to 'timeout' for the reader, then return false without publishing. Once a wait
+  // timed out, the reader is assumed to be stalled or absent, and is no longer waited for until it
+  // frees space. Chunks larger than the ring are never published.
+  bool Publish(const void* data, size_t size, std::chrono::nanoseconds timeout) {
+    const size_t chunk_size = kChunkHeaderSize + Align(size);
+    if (chunk_size > ring_size_) return false;
+
+    uint64_t write_offset = header_->write_offset;
+    size_t position = write_offset & (ring_size_ - 1);
+
+    // A chunk does not wrap around the end of the ring, pad the end of the ring if needed.
+    const size_t padding = position + chunk_size > ring_size_ ? ring_size_ - position : 0;
+    if (padding != 0) {
+      const bool wait = timeout.count() != 0;
+      if (!WaitForSpace(write_offset, padding + (wait ? 0 : chunk_size), timeout)) return false;
+      StoreChunkHeader(position, ROCTRACER_SHM_CHUNK_PADDING | (padding - kChunkHeaderSize));
+      write_offset += padding;
+      position = 0;
+      // Publish the padding right away, so that the reader frees the end of the ring.
+      __atomic_store_n(&header_->write_offset, write_offset, __ATOMIC_RELEASE);
+    }
+    if (!WaitForSpace(write_offset, chunk_size, timeout)) return false;
+
+    StoreChunkHeader(position, size);
+    ::memcpy(ring_ + position + kChunkHeaderSize, data, size);
+    __atomic_store_n(&header_->write_offset, write_offset + chunk_size, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // Writer: account for records dropped because the ring was full.
+  void AddRecordsLost(uint64_t count) {
+    __atomic_fetch_add(&header_->records_lost, count, __ATOMIC_RELAXED);
+  }
+
+  // Writer: tell the reader that no more chunks will be published.
+  void Close() { __atomic_store_n(&header_->closed, 1, __ATOMIC_RELEASE); }
+
+  // Reader: call 'function(begin, end)' with the payload of each chunk published since the last
+  // call, then release the chunks to the writer. Return the number of chunks consumed.
+  template <typename Function> size_t Consume(Function&& function) {
+    const uint64_t write_offset = __atomic_load_n(&header_->write_offset, __ATOMIC_ACQUIRE);
+    uint64_t read_offset = header_->read_offset;
+    size_t count = 0;
+
+    while (read_offset < write_offset) {
+      const size_t position = read_offset & (ring_size_ - 1);
+      uint64_t chunk_header;
+      ::memcpy(&chunk_header, ring_ + position, sizeof(chunk_header));
+      const size_t size = chunk_header & ~ROCTRACER_SHM_CHUNK_PADDING;
+      if (position + kChunkHeaderSize + size > ring_size_) break;  // Corrupted ring.
+
+      if ((chunk_header & ROCTRACER_SHM_CHUNK_PADDING) == 0) {
+        const std::byte* payload = ring_ + position + kChunkHeaderSize;
+        function(payload, payload + size);
+        ++count;
+      }
+      read_offset += kChunkHeaderSize + Align(size);
+    }
+
+    __atomic_store_n(&header_->read_offset, read_offset, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  // Reader: return true if the writer closed the ring. The chunks published before the ring was
+  // closed are visible to the next Consume().
+  bool closed() const { return __atomic_load_n(&header_->closed, __ATOMIC_ACQUIRE) != 0; }
+
+  uint32_t flags() const { return header_->flags; }
+  uint64_t time_base_ns() const { return header_->time_base_ns; }
+  uint32_t writer_pid() const { return header_->writer_pid; }
+  uint64_t records_lost() const {
+    return __atomic_load_n(&header_->records_lost, __ATOMIC_RELAXED);
+  }
+
+ private:
+  static size_t Align(size_t size) { return (size + 7) & ~size_t{7}; }
+
+  static std::system_error SystemError(const char* what, const char* path) {
+    const int error = errno;
+    return std::system_error(error, std::generic_category(), std::string(what) + ' ' + path);
+  }
+
+  // Size the file, unless attaching, and map it. Closes 'fd'.
+  void Map(int fd, size_t size, bool create) {
+    if (create && ::ftruncate(fd, size) == -1) {
+      const int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), "cannot size segment");
+    }
+    void* mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+      throw std::system_error(error, std::generic_category(), "cannot map segment");
+    header_ = static_cast<roctracer_shm_header_t*>(mapping);
+    mapping_size_ = size;
+  }
+
+  void StoreChunkHeader(size_t position, uint64_t chunk_header) {
+    ::memcpy(ring_ + position, &chunk_header, sizeof(chunk_header));
+  }
+
+  // Wait up to 'timeout' until the reader freed enough space to write 'size' bytes at
+  // 'write_offset', and return whether there is enough free space. The reader is not waited for if
+  // it did not read since the last wait timed out.
+  bool WaitForSpace(uint64_t write_offset, size_t size, std::chrono::nanoseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+      const uint64_t read_offset = __atomic_load_n(&header_->read_offset, __ATOMIC_ACQUIRE);
+      if (write_offset + size - read_offset <= ring_size_) return true;
+      if (timeout.count() == 0 || read_offset == stalled_read_offset_) return false;
+      if (std::chrono::steady_clock::now() >= deadline) {
+        stalled_read_offset_ = read_offset;
+        return false;
+      }
+      // The reader is in another process, poll for it.
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  roctracer_shm_header_t* header_{nullptr};
+  size_t mapping_size_{0};
+  std::byte* ring_{nullptr};
+  size_t ring_size_{0};
+  // The read offset when the last wait for the reader timed out.
+  uint64_t stalled_read_offset_{~uint64_t{0}};
+};
+
+}  // namespace roctracer
+
+#endif  // SHARED_MEMORY_RING_H_
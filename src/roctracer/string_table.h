@@ -0,0 +1,115 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+#ifndef STRING_TABLE_H_
+#define STRING_TABLE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace roctracer {
+
+// A process-wide table of interned strings. Each distinct string is stored once and is given a
+// compact ID. The interned strings are never freed, so records can point to them for the lifetime
+// of the process instead of carrying a copy of the string.
+class StringTable {
+ public:
+  // The ID of a null string. Interned strings have IDs starting at 1.
+  static constexpr uint32_t kNoStringId = 0;
+
+  // The table is never destroyed, as records pointing to interned strings may still be processed
+  // while the static objects are being destroyed.
+  static StringTable& Instance() {
+    static auto* instance = new StringTable();
+    return *instance;
+  }
+
+  // Return the interned copy of 'string' and its ID, interning the string if this is its first
+  // use.
+  std::pair<const char*, uint32_t> Intern(std::string_view string) {
+    {
+      std::shared_lock lock(mutex_);
+      if (auto it = ids_.find(string); it != ids_.end())
+        return {strings_[it->second - 1].c_str(), it->second};
+    }
+
+    std::unique_lock lock(mutex_);
+    // Another thread may have interned the string while the lock was released.
+    if (auto it = ids_.find(string); it != ids_.end())
+      return {strings_[it->second - 1].c_str(), it->second};
+
+    // The deque does not move its elements when growing, so the string views used as keys and the
+    // pointers returned to the callers remain valid.
+    const std::string& interned = strings_.emplace_back(string);
+    const auto id = static_cast<uint32_t>(strings_.size());
+    ids_.emplace(interned, id);
+    return {interned.c_str(), id};
+  }
+
+  // Same as Intern(), but first look 'string' up in a small cache of the calling thread indexed by
+  // its address, so that the repeated uses of a string, for example the name of a kernel that is
+  // dispatched many times, do not take the table lock. The cached string is compared with 'string',
+  // as the address may have been reused for another string.
+  std::pair<const char*, uint32_t> InternCached(const char* string) {
+    struct CacheEntry {
+      const char* key;
+      const char* interned;
+      uint32_t id;
+    };
+    thread_local std::array<CacheEntry, kCacheSize> cache{};
+
+    const auto address = reinterpret_cast<uintptr_t>(string);
+    CacheEntry& entry = cache[(address ^ (address >> 8)) % kCacheSize];
+    if (entry.key == string && strcmp(entry.interned, string) == 0)
+      return {entry.interned, entry.id};
+
+    auto [interned, id] = Intern(string);
+    entry = {string, interned, id};
+    return {interned, id};
+  }
+
+  // Return the interned string with the given ID, or nullptr if the ID is not valid.
+  const char* Lookup(uint32_t id) const {
+    std::shared_lock lock(mutex_);
+    return (id != kNoStringId && id <= strings_.size()) ? strings_[id - 1].c_str() : nullptr;
+  }
+
+ private:
+  StringTable() = default;
+
+  static constexpr size_t kCacheSize = 64;
+
+  mutable std::shared_mutex mutex_;
+  std::deque<std::string> strings_;  // Indexed by string ID - 1.
+  std::unordered_map<std::string_view, uint32_t> ids_;
+};
+
+}  // namespace roctracer
+
+#endif  // STRING_TABLE_H_
@@ -21,18 +21,23 @@
 #ifndef TOOL_TRACE_BUFFER_H_
 #define TOOL_TRACE_BUFFER_H_
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
 #include <functional>
 #include <future>
 #include <iostream>
-#include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 namespace roctracer {
 
@@ -76,6 +81,12 @@ class TraceBufferBase {
 
   virtual void Flush() = 0;
 
+  // Flush this trace buffer, serialized with the flushes of all the other trace buffers.
+  void FlushSynchronized() {
+    std::lock_guard lock(mutex_);
+    Flush();
+  }
+
   std::string name() && { return std::move(name_); }
   const std::string& name() const& { return name_; }
 
@@ -90,23 +101,55 @@ class TraceBufferBase {
 
 enum TraceEntryState { TRACE_ENTRY_INVALID = 0, TRACE_ENTRY_INIT = 1, TRACE_ENTRY_COMPLETE = 2 };
 
+// In the shared mode, all the threads append entries to the same chunks. In the sharded mode, each
+// thread appends entries to its own shard of chunks without synchronizing with the other threads,
+// and the shards are merged when flushed.
+enum class TraceBufferMode { kShared, kSharded };
+
+// In the in-order flush mode, a flush stops at the first incomplete entry of the shared chunks, and
+// the entries written after it are held back until it is complete. In the skip-incomplete mode, a
+// flush passes over the incomplete entries and flushes them with a later flush, once complete.
+enum class TraceFlushMode { kInOrder, kSkipIncomplete };
+
+// What to do when an entry needs a new chunk and the trace buffer's chunk limit is reached: wait
+// for a flush to release a chunk, drop the entry, or flush the trace buffer from the writing thread
+// and drop the entry if that did not release a chunk.
+enum class TraceOverflowPolicy { kBlock, kDrop, kFlush };
+
+// The entries have an atomic 'valid' member, which the writer stores TRACE_ENTRY_COMPLETE to with
+// release semantics once the entry is filled in. It is constructed, as TRACE_ENTRY_INVALID, when
+// the chunk is allocated, and the entry constructors must leave it default-initialized: a flush may
+// be reading it while the entry is constructed.
 template <typename Entry, typename Allocator = std::allocator<Entry>>
 class TraceBuffer : protected TraceBufferBase {
  public:
   using callback_t = std::function<void(Entry*)>;
-
-  TraceBuffer(std::string name, uint64_t size, callback_t flush_callback, int priority = 0)
+  // Receives the contiguous complete entries [begin, end), so that they can be processed in a
+  // single pass. The entries are destroyed after the callback returns.
+  using span_callback_t = std::function<void(Entry* begin, Entry* end)>;
+  // Returns the key the entries of different shards are merged in, for example a timestamp.
+  using order_key_t = std::function<uint64_t(const Entry&)>;
+
+  // In the sharded mode, if 'order_key' is set, the entries of all the shards flushed together are
+  // passed to the flush callback in increasing key order. Otherwise, the entries are passed to the
+  // callback shard by shard. In both modes, the entries of a thread are flushed in the order they
+  // were written.
+  TraceBuffer(std::string name, uint64_t size, span_callback_t flush_callback, int priority = 0,
+              TraceBufferMode mode = TraceBufferMode::kShared, order_key_t order_key = {},
+              TraceFlushMode flush_mode = TraceFlushMode::kInOrder)
       : TraceBufferBase(std::move(name), priority),
         flush_callback_(std::move(flush_callback)),
-        size_(size) {
+        size_(size),
+        sharded_(mode == TraceBufferMode::kSharded),
+        order_key_(std::move(order_key)),
+        skip_incomplete_(flush_mode == TraceFlushMode::kSkipIncomplete) {
     assert(size_ != 0 && "cannot create an empty trace buffer");
 
-    Entry* write_buffer = allocator_.allocate(size_);
-    assert(write_buffer != nullptr);
-    buffer_list_.push_back(write_buffer);
+    Chunk* write_chunk = AllocateChunk();
+    first_chunk_ = last_chunk_ = write_chunk;
 
     read_index_ = 0;
-    write_index_ = {0, write_buffer};
+    write_index_ = {0, write_chunk};
 
     AllocateFreeBuffer();
 
@@ -114,20 +157,48 @@ class TraceBuffer : protected TraceBufferBase {
     Register(this);
   }
 
+  // Same as above, but the flush callback is invoked once per entry.
+  TraceBuffer(std::string name, uint64_t size, callback_t flush_callback, int priority = 0,
+              TraceBufferMode mode = TraceBufferMode::kShared, order_key_t order_key = {},
+              TraceFlushMode flush_mode = TraceFlushMode::kInOrder)
+      : TraceBuffer(
+            std::move(name), size,
+            [callback = std::move(flush_callback)](Entry* begin, Entry* end) {
+              while (begin != end) callback(begin++);
+            },
+            priority, mode, std::move(order_key), flush_mode) {}
+
   ~TraceBuffer() override {
     // Flush the remaining records. After flushing, there should not be any records left in the
     // trace buffer.
     Flush();
     assert(read_index_ == write_index_.load().index);
+    assert(holes_.empty() && "incomplete entries left in the trace buffer");
+
+    // Detach the shards from this trace buffer, and deallocate their chunks. The shards may still
+    // be referenced by their owner thread's shard list, but they will not be used again.
+    {
+      std::lock_guard shards_lock(shards_mutex_);
+      for (auto&& shard : shards_) {
+        shard->closed.store(true, std::memory_order_relaxed);
+        FreeShard(*shard);
+      }
+      shards_.clear();
+    }
 
     // Acquire both the writer and worker lock as we are accessing shared variables they protect.
     std::unique_lock writer_lock(write_mutex_, std::defer_lock);
     std::unique_lock worker_lock(worker_mutex_, std::defer_lock);
     std::lock(writer_lock, worker_lock);
 
-    // Deallocate the buffers.
-    allocator_.deallocate(write_index_.load().buffer, size_);
-    allocator_.deallocate(free_buffer_, size_);
+    // Deallocate the chunks. The chunks that are no longer in the chunk list are only referenced by
+    // their holes.
+    for (auto&& hole : holes_)
+      if (hole.index < first_chunk_begin_ && --hole.chunk->holes == 0) DeallocateChunk(hole.chunk);
+    DeallocateChunk(write_index_.load().buffer);
+    if (free_buffer_ != nullptr) DeallocateChunk(free_buffer_);
+    while (free_chunks_ != nullptr)
+      DeallocateChunk(std::exchange(free_chunks_, free_chunks_->next));
 
     // Stop the worker thread. The worker thread loop checks the 'worker_thread_' std::optional
     // after waking up, and exits if it does not have a value.
@@ -145,52 +216,140 @@ class TraceBuffer : protected TraceBufferBase {
     }
   }
 
-  // Flush all entries between read_pointer and write_pointer. read_pointer and write_pointer are
-  // monotonically increasing indices, with read_pointer % size always indexing inside the first
-  // buffer in the list. Stop flushing if an incomplete entry is found, it will be flushed with
-  // the next invocation after changing its state to 'complete'.
+  // Flush the entries of the shared chunks, then the entries of the shards.
   void Flush() override {
-    std::lock_guard lock(write_mutex_);
-    auto write_index = write_index_.load(std::memory_order_relaxed);
+    FlushShared();
+    if (sharded_) FlushShards();
+  }
 
-    for (auto it = buffer_list_.begin(); it != buffer_list_.end();) {
-      auto end_of_buffer = read_index_ - read_index_ % size_ + size_;
+  // Construct a new entry. Use TryEmplace() instead if a chunk limit is set.
+  template <typename... Args> Entry& Emplace(Args... args) {
+    Entry* entry = TryEmplace(std::forward<Args>(args)...);
+    assert(entry != nullptr && "the entry was dropped");
+    return *entry;
+  }
 
-      while (read_index_ < std::min(write_index.index, end_of_buffer)) {
-        Entry* entry = &(*it)[read_index_ % size_];
+  // Construct a new entry, or return nullptr if the entry is dropped because the chunk limit is
+  // reached.
+  template <typename... Args> Entry* TryEmplace(Args... args) {
+    Entry* entry = sharded_ ? GetShardEntry() : GetEntry();
+    if (entry == nullptr) {
+      dropped_entries_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    // Default-initialize the entry if there are no arguments, so that its 'valid' flag is not
+    // value-initialized.
+    if constexpr (sizeof...(Args) == 0)
+      return new (entry) Entry;
+    else
+      return new (entry) Entry(std::forward<Args>(args)...);
+  }
 
-        // The entry is not yet complete, stop flushing here.
-        if (entry->valid.load(std::memory_order_acquire) != TRACE_ENTRY_COMPLETE) return;
+  // Limit the number of chunks of entries waiting to be flushed to 'max_chunks', 0 meaning no
+  // limit, and set the policy applied when an entry needs a new chunk while at the limit. Each
+  // writer (each shard in the sharded mode) also holds the chunk it is writing, which does not
+  // count towards the limit. Must be called before the first entry is written.
+  void SetChunkLimit(size_t max_chunks, TraceOverflowPolicy overflow_policy) {
+    max_chunks_ = max_chunks;
+    overflow_policy_ = overflow_policy;
+  }
 
-        flush_callback_(entry);
-        entry->~Entry();
+  // The number of entries dropped because the chunk limit was reached.
+  uint64_t dropped_entries() const { return dropped_entries_.load(std::memory_order_relaxed); }
 
+  // The total time the writers waited for the worker thread to allocate the next free chunk.
+  uint64_t free_buffer_wait_ns() const {
+    return free_buffer_wait_ns_.load(std::memory_order_relaxed);
+  }
+
+  using TraceBufferBase::name;
+
+ private:
+  // Flush all entries between read_pointer and write_pointer. read_pointer and write_pointer are
+  // monotonically increasing indices, with read_pointer always indexing inside the first chunk in
+  // the list. In the in-order mode, stop flushing if an incomplete entry is found, it will be
+  // flushed with the next invocation after changing its state to 'complete'. In the
+  // skip-incomplete mode, remember the incomplete entry as a hole and continue.
+  void FlushShared() {
+    std::lock_guard lock(write_mutex_);
+    auto write_index = write_index_.load(std::memory_order_relaxed);
+
+    // Flush the holes left by the previous invocations first, they are older than the entries
+    // at the read pointer.
+    if (!holes_.empty()) FlushHoles();
+
+    while (first_chunk_ != nullptr) {
+      // The chunks are linked at multiples of 'size_', but the end of the first chunk cannot be
+      // derived from the read pointer once the read pointer reached it.
+      const uint64_t end_of_buffer = first_chunk_begin_ + size_;
+
+      const uint64_t end_of_entries = std::min(write_index.index, end_of_buffer);
+      while (read_index_ < end_of_entries) {
+        // Flush the complete entries starting at the read pointer as a single span.
+        Entry* begin = &first_chunk_->entries()[read_index_ - first_chunk_begin_];
+        Entry* end = begin;
+        while (read_index_ < end_of_entries &&
+               end->valid.load(std::memory_order_acquire) == TRACE_ENTRY_COMPLETE) {
+          ++end;
+          ++read_index_;
+        }
+        if (begin != end) FlushSpan(begin, end);
+        if (read_index_ == end_of_entries) break;
+
+        // The entry is not yet complete. Stop flushing here, or skip the entry and remember it as
+        // a hole.
+        if (!skip_incomplete_) return;
+        holes_.push_back({read_index_, first_chunk_});
+        ++first_chunk_->holes;
         ++read_index_;
       }
 
-      // The buffer is still in use or the read pointer did not reach the end of the buffer.
-      if (*it == write_index.buffer || read_index_ != end_of_buffer) return;
+      // The chunk is still in use or the read pointer did not reach the end of the chunk.
+      if (first_chunk_ == write_index.buffer || read_index_ != end_of_buffer) return;
 
-      // All entries in the current buffer are now processed. Destroy the buffer and move onto the
-      // next buffer in the list.
-      allocator_.deallocate(*it, size_);
-      it = buffer_list_.erase(it);
+      // All entries in the current chunk are now processed. Move onto the next chunk in the list,
+      // and recycle the chunk unless it still has holes, in which case it is recycled when its
+      // last hole is flushed.
+      Chunk* chunk = std::exchange(first_chunk_, first_chunk_->next);
+      first_chunk_begin_ += size_;
+      if (chunk->holes == 0) ReleaseChunk(chunk);
     }
   }
 
-  template <typename... Args> Entry& Emplace(Args... args) {
-    return *new (GetEntry()) Entry(std::forward<Args>(args)...);
+  // Pass the entries [begin, end) to the flush callback, then destroy them.
+  void FlushSpan(Entry* begin, Entry* end) {
+    flush_callback_(begin, end);
+    std::destroy(begin, end);
   }
 
- private:
+  // Flush the holes whose entries are now complete, and recycle the chunks that are no longer in
+  // the chunk list once their last hole is flushed. Must be called with the writer lock held.
+  void FlushHoles() {
+    auto remaining = holes_.begin();
+    for (auto&& hole : holes_) {
+      Entry* entry = &hole.chunk->entries()[hole.index % size_];
+      if (entry->valid.load(std::memory_order_acquire) != TRACE_ENTRY_COMPLETE) {
+        *remaining++ = hole;
+        continue;
+      }
+
+      FlushSpan(entry, entry + 1);
+      if (--hole.chunk->holes == 0 && hole.index < first_chunk_begin_) ReleaseChunk(hole.chunk);
+    }
+    holes_.erase(remaining, holes_.end());
+  }
+
+  // The write index is published with release semantics when it is moved to a new chunk, and
+  // loaded with acquire semantics, so that the writers see the chunk as initialized by the thread
+  // that allocated it.
   Entry* GetEntry() {
-    auto current = write_index_.load(std::memory_order_relaxed);
+    auto current = write_index_.load(std::memory_order_acquire);
 
     while (true) {
       // If the pointer is at the end of the current buffer, switch to the available free buffer and
       // notify the worker thread to allocate a new buffer.
       if (current.index != 0 && current.index % size_ == 0) {
-        std::lock_guard lock(write_mutex_);
+        std::unique_lock lock(write_mutex_);
 
         // If the worker thread wasn't already started, start it now. This avoids starting a new
         // thread when the trace buffer is created.
@@ -206,40 +365,153 @@ class TraceBuffer : protected TraceBufferBase {
 
         // Re-check the pointer overflow under the writer lock, another thread could have beaten us
         // to it and already bumped the write_index_.
-        current = write_index_.load(std::memory_order_relaxed);
+        current = write_index_.load(std::memory_order_acquire);
         if (current.index % size_ == 0) {
+          // The chunk limit is reached. Apply the overflow policy without holding the writer
+          // lock, which the flushes need, then start over.
+          if (!TryReserveChunk()) {
+            lock.unlock();
+            if (!WaitForChunk()) return nullptr;
+            current = write_index_.load(std::memory_order_acquire);
+            continue;
+          }
+
           std::unique_lock worker_lock(worker_mutex_);
 
-          // Wait for the free buffer to become available.
-          worker_cond_.wait(worker_lock, [this]() { return free_buffer_ != nullptr; });
+          // Wait for the free buffer to become available, and account for the time spent waiting.
+          if (free_buffer_ == nullptr) {
+            const auto wait_start = std::chrono::steady_clock::now();
+            worker_cond_.wait(worker_lock, [this]() { return free_buffer_ != nullptr; });
+            free_buffer_wait_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                               std::chrono::steady_clock::now() - wait_start)
+                                               .count(),
+                                           std::memory_order_relaxed);
+          }
 
           current.buffer = free_buffer_;
-          buffer_list_.push_back(current.buffer);
-          write_index_.store({current.index + 1, current.buffer}, std::memory_order_relaxed);
+          current.buffer->next = nullptr;
+          last_chunk_->next = current.buffer;
+          last_chunk_ = current.buffer;
+          write_index_.store({current.index + 1, current.buffer}, std::memory_order_release);
 
           // Tell the worker thread to allocate a new free buffer.
           free_buffer_ = nullptr;
           worker_cond_.notify_one();
 
           // We successfully allocated a new buffer, return the first element.
-          return &current.buffer[0];
+          return &current.buffer->entries()[0];
         }
       }
 
       if (write_index_.compare_exchange_weak(current, {current.index + 1, current.buffer},
-                                             std::memory_order_relaxed))
-        return &current.buffer[current.index % size_];
+                                             std::memory_order_acquire))
+        return &current.buffer->entries()[current.index % size_];
+    }
+  }
+
+  // A chunk of 'size_' entries, preceded by the link to the next chunk in the buffer's chunk list
+  // or in the free list, so that the lists do not allocate memory, and by the number of holes
+  // (entries skipped by a flush because they were incomplete) the chunk contains.
+  struct Chunk {
+    Chunk* next;
+    size_t holes;
+    Entry* entries() {
+      return reinterpret_cast<Entry*>(reinterpret_cast<std::byte*>(this) + kEntriesOffset);
+    }
+  };
+  static constexpr size_t kEntriesOffset =
+      (sizeof(Chunk) + alignof(Entry) - 1) & ~(alignof(Entry) - 1);
+  static_assert(alignof(Entry) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+  // The maximum number of flushed chunks kept for reuse. The chunks in excess are deallocated.
+  static constexpr size_t kMaxFreeChunks = 4;
+
+  size_t ChunkSize() const { return kEntriesOffset + size_ * sizeof(Entry); }
+
+  // Allocate a chunk, and construct the 'valid' flags of its entries as not yet written.
+  Chunk* AllocateChunk() {
+    auto* chunk = reinterpret_cast<Chunk*>(allocator_.allocate(ChunkSize()));
+    assert(chunk != nullptr);
+    chunk->next = nullptr;
+    chunk->holes = 0;
+    Entry* entries = chunk->entries();
+    for (size_t i = 0; i < size_; ++i)
+      new (&entries[i].valid) decltype(Entry::valid)(TRACE_ENTRY_INVALID);
+    return chunk;
+  }
+
+  void DeallocateChunk(Chunk* chunk) {
+    allocator_.deallocate(reinterpret_cast<std::byte*>(chunk), ChunkSize());
+  }
+
+  // Return a flushed chunk to the free list, to be reused by the worker thread. Must be called
+  // with the writer lock held.
+  void ReleaseChunk(Chunk* chunk) {
+    UnreserveChunk();
+    std::lock_guard worker_lock(worker_mutex_);
+    if (free_chunk_count_ == kMaxFreeChunks) return DeallocateChunk(chunk);
+    chunk->next = free_chunks_;
+    free_chunks_ = chunk;
+    ++free_chunk_count_;
+  }
+
+  // Account for a chunk of entries waiting to be flushed, a chunk that is full and that is no
+  // longer written. Return false if the chunk limit is reached.
+  bool TryReserveChunk() {
+    if (chunk_count_.fetch_add(1, std::memory_order_relaxed) < max_chunks_ || max_chunks_ == 0)
+      return true;
+    UnreserveChunk();
+    return false;
+  }
+
+  // Account for a flushed chunk, and wake up the writers waiting for one.
+  void UnreserveChunk() {
+    chunk_count_.fetch_sub(1, std::memory_order_relaxed);
+    if (max_chunks_ != 0 && overflow_policy_ == TraceOverflowPolicy::kBlock) {
+      std::lock_guard capacity_lock(capacity_mutex_);
+      capacity_cond_.notify_all();
     }
   }
 
+  // Apply the overflow policy when the chunk limit is reached. Return true if a chunk was
+  // released and the entry can be written, or false if the entry should be dropped.
+  bool WaitForChunk() {
+    switch (overflow_policy_) {
+      case TraceOverflowPolicy::kBlock: {
+        std::unique_lock capacity_lock(capacity_mutex_);
+        capacity_cond_.wait(capacity_lock, [this]() {
+          return chunk_count_.load(std::memory_order_relaxed) < max_chunks_;
+        });
+        return true;
+      }
+      case TraceOverflowPolicy::kFlush:
+        FlushSynchronized();
+        return chunk_count_.load(std::memory_order_relaxed) < max_chunks_;
+      case TraceOverflowPolicy::kDrop:
+        break;
+    }
+    return false;
+  }
+
+  // Prepare the next free buffer, reusing a flushed chunk if one is available. Must be called with
+  // the worker lock held.
   void AllocateFreeBuffer() {
     assert(free_buffer_ == nullptr);
 
-    free_buffer_ = allocator_.allocate(size_);
-    assert(free_buffer_ != nullptr);
+    if (free_chunks_ != nullptr) {
+      free_buffer_ = std::exchange(free_chunks_, free_chunks_->next);
+      --free_chunk_count_;
+      InitializeChunk(free_buffer_);
+    } else {
+      free_buffer_ = AllocateChunk();
+    }
+  }
 
+  // Mark the entries of a flushed chunk as not yet written.
+  void InitializeChunk(Chunk* chunk) {
+    Entry* entries = chunk->entries();
     for (size_t i = 0; i < size_; ++i)
-      free_buffer_[i].valid.store(TRACE_ENTRY_INVALID, std::memory_order_relaxed);
+      entries[i].valid.store(TRACE_ENTRY_INVALID, std::memory_order_relaxed);
   }
 
   void WorkerThreadLoop(std::promise<void> ready) {
@@ -256,29 +528,269 @@ class TraceBuffer : protected TraceBufferBase {
     }
   }
 
+  // A shard is a chain of chunks written by a single thread, its owner. The owner appends entries
+  // with plain stores and publishes them by advancing 'write_index'. The flushing thread consumes
+  // the entries from 'read_index' and returns the flushed chunks to the shard's free list.
+  struct Shard {
+    Chunk* write_chunk{nullptr};  // Only accessed by the owner thread.
+    std::atomic<uint64_t> write_index{0};
+
+    // Only accessed by the flushing thread, with the shards mutex held.
+    Chunk* first_chunk{nullptr};
+    uint64_t first_chunk_begin{0};  // The index of the first chunk's first entry.
+    uint64_t read_index{0};
+    uint64_t flush_index{0};  // The end of the entries collected by the current flush.
+
+    std::mutex mutex;  // Protects the free list.
+    Chunk* free_chunks{nullptr};
+    size_t free_chunk_count{0};
+
+    std::atomic<bool> orphaned{false};  // The owner thread has exited.
+    std::atomic<bool> closed{false};    // The trace buffer owning this shard was destroyed.
+  };
+
+  // The shards owned by a thread, one per trace buffer in sharded mode. The shards are shared with
+  // the trace buffers so that either the thread or the trace buffer can go away first. The list is
+  // marked invalid when destructed so that late writes from other TLS destructors can detect it
+  // and use the shared chunks instead.
+  class ShardList {
+   public:
+    ShardList() { valid_.store(true, std::memory_order_relaxed); }
+    ~ShardList() {
+      valid_.store(false, std::memory_order_relaxed);
+      for (auto&& [id, shard] : shards_) shard->orphaned.store(true, std::memory_order_release);
+    }
+
+    Shard* Find(uint64_t id) const {
+      for (auto&& [shard_id, shard] : shards_)
+        if (shard_id == id) return shard.get();
+      return nullptr;
+    }
+
+    void Add(uint64_t id, std::shared_ptr<Shard> shard) {
+      // Drop the shards of trace buffers that no longer exist before adding a new one.
+      shards_.erase(std::remove_if(shards_.begin(), shards_.end(),
+                                   [](auto&& entry) {
+                                     return entry.second->closed.load(std::memory_order_relaxed);
+                                   }),
+                    shards_.end());
+      shards_.emplace_back(id, std::move(shard));
+    }
+
+    bool is_valid() const { return valid_.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<bool> valid_{false};
+    std::vector<std::pair<uint64_t, std::shared_ptr<Shard>>> shards_;
+  };
+
+  // Return the calling thread's shard, creating it if necessary, or nullptr if the thread's shard
+  // list was already destructed.
+  Shard* GetShard() {
+    static thread_local ShardList thread_shards;
+    if (!thread_shards.is_valid()) return nullptr;
+    if (Shard* shard = thread_shards.Find(id_); shard != nullptr) return shard;
+
+    auto shard = std::make_shared<Shard>();
+    shard->write_chunk = shard->first_chunk = AllocateChunk();
+    {
+      std::lock_guard shards_lock(shards_mutex_);
+      shards_.push_back(shard);
+    }
+    thread_shards.Add(id_, shard);
+    return shard.get();
+  }
+
+  // Return the next entry of the calling thread's shard.
+  Entry* GetShardEntry() {
+    // Entries written after the calling thread's shard list is destroyed (by TLS destructors) go
+    // to the shared chunks.
+    Shard* shard = GetShard();
+    if (shard == nullptr) return GetEntry();
+
+    const uint64_t index = shard->write_index.load(std::memory_order_relaxed);
+    if (index != 0 && index % size_ == 0) {
+      while (!TryReserveChunk())
+        if (!WaitForChunk()) return nullptr;
+
+      // Link a new chunk, taken from the free list if possible, before publishing its first entry.
+      Chunk* chunk = nullptr;
+      {
+        std::lock_guard shard_lock(shard->mutex);
+        if (shard->free_chunks != nullptr) {
+          chunk = std::exchange(shard->free_chunks, shard->free_chunks->next);
+          --shard->free_chunk_count;
+        }
+      }
+      if (chunk == nullptr) chunk = AllocateChunk();
+      chunk->next = nullptr;
+      shard->write_chunk->next = chunk;
+      shard->write_chunk = chunk;
+    }
+
+    shard->write_index.store(index + 1, std::memory_order_release);
+    return &shard->write_chunk->entries()[index % size_];
+  }
+
+  // Flush the complete entries of all the shards, in key order if an order key is set, and
+  // remove the shards of the exited threads once all their entries are flushed.
+  void FlushShards() {
+    std::lock_guard shards_lock(shards_mutex_);
+
+    for (auto&& shard : shards_) {
+      CollectShardEntries(*shard);
+      if (!order_key_) FlushEntries();
+    }
+    if (order_key_) {
+      std::stable_sort(flush_entries_.begin(), flush_entries_.end(),
+                       [this](const Entry* a, const Entry* b) {
+                         return order_key_(*a) < order_key_(*b);
+                       });
+      FlushEntries();
+    }
+
+    for (auto it = shards_.begin(); it != shards_.end();) {
+      Shard& shard = **it;
+      const bool orphaned = shard.orphaned.load(std::memory_order_acquire);
+      AdvanceShard(shard);
+      if (orphaned && shard.read_index == shard.write_index.load(std::memory_order_acquire)) {
+        FreeShard(shard);
+        it = shards_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Add the complete entries of the shard, starting at its read index, to 'flush_entries_'. Stop
+  // at the first incomplete entry. Must be called with the shards mutex held.
+  void CollectShardEntries(Shard& shard) {
+    const uint64_t write_index = shard.write_index.load(std::memory_order_acquire);
+    Chunk* chunk = shard.first_chunk;
+    uint64_t chunk_begin = shard.first_chunk_begin;
+
+    for (shard.flush_index = shard.read_index; shard.flush_index < write_index;
+         ++shard.flush_index) {
+      if (shard.flush_index == chunk_begin + size_) {
+        chunk = chunk->next;
+        chunk_begin += size_;
+      }
+      Entry* entry = &chunk->entries()[shard.flush_index - chunk_begin];
+      if (entry->valid.load(std::memory_order_acquire) != TRACE_ENTRY_COMPLETE) break;
+      flush_entries_.push_back(entry);
+    }
+  }
+
+  // Pass the collected entries to the flush callback, in spans of entries adjacent in memory,
+  // then destroy them.
+  void FlushEntries() {
+    for (size_t i = 0; i < flush_entries_.size();) {
+      Entry* begin = flush_entries_[i];
+      Entry* end = begin + 1;
+      for (++i; i < flush_entries_.size() && flush_entries_[i] == end; ++i) ++end;
+      FlushSpan(begin, end);
+    }
+    flush_entries_.clear();
+  }
+
+  // Advance the read index of the shard past the flushed entries, and recycle the chunks that
+  // were entirely flushed. A chunk is only recycled once the owner linked the next chunk to it,
+  // which it does before publishing the next chunk's first entry. Must be called with the shards
+  // mutex held.
+  void AdvanceShard(Shard& shard) {
+    shard.read_index = shard.flush_index;
+    const uint64_t write_index = shard.write_index.load(std::memory_order_acquire);
+
+    while (shard.first_chunk_begin + size_ <= shard.read_index &&
+           shard.first_chunk_begin + size_ < write_index) {
+      Chunk* chunk = std::exchange(shard.first_chunk, shard.first_chunk->next);
+      shard.first_chunk_begin += size_;
+
+      InitializeChunk(chunk);
+      UnreserveChunk();
+      std::lock_guard shard_lock(shard.mutex);
+      if (shard.free_chunk_count == kMaxFreeChunks) {
+        DeallocateChunk(chunk);
+      } else {
+        chunk->next = shard.free_chunks;
+        shard.free_chunks = chunk;
+        ++shard.free_chunk_count;
+      }
+    }
+  }
+
+  // Deallocate the chunks of a shard whose owner thread exited, or of a trace buffer being
+  // destroyed. Must be called with the shards mutex held.
+  void FreeShard(Shard& shard) {
+    while (shard.first_chunk != nullptr) {
+      // Only the chunk being written is not accounted for.
+      if (shard.first_chunk->next != nullptr) UnreserveChunk();
+      DeallocateChunk(std::exchange(shard.first_chunk, shard.first_chunk->next));
+    }
+    while (shard.free_chunks != nullptr)
+      DeallocateChunk(std::exchange(shard.free_chunks, shard.free_chunks->next));
+  }
+
   // The WriteIndex is used to store both the index and the buffer associated with that index (the
   // buffer contains the trace buffer records at [index - index % size, index - index % size_t +
   // size_ - 1]) in a single atomic variable.
   struct WriteIndex {
     uint64_t index;
-    Entry* buffer;
+    Chunk* buffer;
+  };
+
+  // An incomplete entry skipped by a flush, and the chunk it is in.
+  struct Hole {
+    uint64_t index;
+    Chunk* chunk;
   };
 
-  const callback_t flush_callback_;
+  const span_callback_t flush_callback_;
   const uint64_t size_;
+  const bool sharded_;
+  const order_key_t order_key_;
+  const bool skip_incomplete_;
 
   uint64_t read_index_;                  // The index of the next record to flush.
   std::atomic<WriteIndex> write_index_;  // The index of the next record that could be written.
-  Entry* free_buffer_{nullptr};          // The next available free buffer.
+  Chunk* free_buffer_{nullptr};          // The next available free buffer.
 
   std::optional<std::thread> worker_thread_;
   std::mutex worker_mutex_;
   std::condition_variable worker_cond_;
+  Chunk* free_chunks_{nullptr};  // The flushed chunks kept for reuse, protected by worker_mutex_.
+  size_t free_chunk_count_{0};
+  std::atomic<uint64_t> free_buffer_wait_ns_{0};  // See free_buffer_wait_ns().
 
+  // The chunks holding entries not yet flushed, from the oldest to the one being written.
   std::mutex write_mutex_;
-  std::list<Entry*> buffer_list_;
-  Allocator allocator_;
+  Chunk* first_chunk_{nullptr};
+  uint64_t first_chunk_begin_{0};  // The index of the first chunk's first entry.
+  Chunk* last_chunk_{nullptr};
+  std::vector<Hole> holes_;  // The incomplete entries skipped by the flushes, oldest first.
+
+  // The chunk limit. 'chunk_count_' counts the chunks waiting to be flushed, in the shared chunk
+  // list (including the chunks only referenced by holes) and in the shards.
+  size_t max_chunks_{0};
+  TraceOverflowPolicy overflow_policy_{TraceOverflowPolicy::kBlock};
+  std::atomic<size_t> chunk_count_{0};
+  std::atomic<uint64_t> dropped_entries_{0};
+  std::mutex capacity_mutex_;
+  std::condition_variable capacity_cond_;
+  typename std::allocator_traits<Allocator>::template rebind_alloc<std::byte> allocator_;
+
+  // Sharded mode. The shard list and the entries collected by a flush are protected by the shards
+  // mutex.
+  std::vector<std::shared_ptr<Shard>> shards_;
+  std::vector<Entry*> flush_entries_;
+  std::mutex shards_mutex_;
+
+  // Unique ID used to find the calling thread's shard. IDs are never reused, so a stale shard left
+  // in a thread's shard list can never be mistaken for a shard of a new trace buffer.
+  static inline std::atomic<uint64_t> next_id_{1};
+  const uint64_t id_{next_id_.fetch_add(1, std::memory_order_relaxed)};
 };
+
 }  // namespace roctracer
 
 #define TRACE_BUFFER_INSTANTIATE()                                                                 \
@@ -101,6 +101,104 @@ size_t GetBufferSize() {
   return std::stoll({bufSize});
 }
 
+// Return the mode of the API trace buffers. If ROCTRACER_TRACE_BUFFER_SHARDS is set, each thread
+// writes its API records to its own shard of the trace buffers, and the shards are merged in
+// timestamp order when flushed.
+roctracer::TraceBufferMode GetTraceBufferMode() {
+  auto shards = getenv("ROCTRACER_TRACE_BUFFER_SHARDS");
+  return shards && strcmp(shards, "0") != 0 ? roctracer::TraceBufferMode::kSharded
+                                            : roctracer::TraceBufferMode::kShared;
+}
+
+// Return the flush mode of the API trace buffers. If ROCTRACER_TRACE_BUFFER_SKIP_INCOMPLETE is
+// set, the flushes do not wait for the records of the threads preempted while writing them, and
+// flush these records later, once complete.
+roctracer::TraceFlushMode GetTraceFlushMode() {
+  auto skip = getenv("ROCTRACER_TRACE_BUFFER_SKIP_INCOMPLETE");
+  return skip && strcmp(skip, "0") != 0 ? roctracer::TraceFlushMode::kSkipIncomplete
+                                        : roctracer::TraceFlushMode::kInOrder;
+}
+
+// Limit the number of chunks of records waiting to be flushed in each API trace buffer if
+// ROCTRACER_TRACE_BUFFER_MAX_CHUNKS is set. When the limit is reached, the writing thread flushes
+// the trace buffer itself, or blocks until the trace buffer is flushed, or drops the record,
+// depending on ROCTRACER_TRACE_BUFFER_OVERFLOW ("flush", "block" or "drop").
+template <typename Buffer> void SetTraceBufferLimit(Buffer& trace_buffer) {
+  auto max_chunks = getenv("ROCTRACER_TRACE_BUFFER_MAX_CHUNKS");
+  if (!max_chunks) return;
+
+  auto policy = getenv("ROCTRACER_TRACE_BUFFER_OVERFLOW");
+  roctracer::TraceOverflowPolicy overflow_policy;
+  // Flush from the writing thread if not set, the trace buffers are not flushed periodically
+  // unless ROCP_FLUSH_RATE is set.
+  if (!policy || strcmp(policy, "flush") == 0)
+    overflow_policy = roctracer::TraceOverflowPolicy::kFlush;
+  else if (strcmp(policy, "block") == 0)
+    overflow_policy = roctracer::TraceOverflowPolicy::kBlock;
+  else if (strcmp(policy, "drop") == 0)
+    overflow_policy = roctracer::TraceOverflowPolicy::kDrop;
+  else
+    fatal("ROCTRACER_TRACE_BUFFER_OVERFLOW: invalid policy '%s'", policy);
+
+  trace_buffer.SetChunkLimit(std::stoul({max_chunks}), overflow_policy);
+}
+
+size_t GetBufferCount() {
+  auto bufCount = getenv("ROCTRACER_BUFFER_COUNT");
+  // Double buffering if not set
+  if (!bufCount) return 2;
+  return std::stoll({bufCount});
+}
+
+// Return the pool mode flags selecting the page allocator, and the NUMA node to bind the buffers
+// to if any.
+uint32_t GetBufferAllocationMode(int* numa_node) {
+  uint32_t mode = 0;
+  if (auto huge_pages = getenv("ROCTRACER_BUFFER_HUGE_PAGES");
+      huge_pages && strcmp(huge_pages, "0") != 0)
+    mode |= ROCTRACER_POOL_MODE_HUGE_PAGES;
+  if (auto node = getenv("ROCTRACER_BUFFER_NUMA_NODE")) {
+    mode |= ROCTRACER_POOL_MODE_NUMA_BIND;
+    // Use the node local to the thread opening the pool if set to "local".
+    *numa_node = strcmp(node, "local") == 0 ? -1 : std::stoi({node});
+  }
+  return mode;
+}
+
+roctracer_pool_overflow_policy_t GetOverflowPolicy(
+    roctracer_pool_overflow_policy_t default_policy) {
+  auto policy = getenv("ROCTRACER_OVERFLOW_POLICY");
+  if (!policy) return default_policy;
+  if (strcmp(policy, "block") == 0) return ROCTRACER_POOL_OVERFLOW_BLOCK;
+  if (strcmp(policy, "drop-newest") == 0) return ROCTRACER_POOL_OVERFLOW_DROP_NEWEST;
+  if (strcmp(policy, "drop-oldest") == 0) return ROCTRACER_POOL_OVERFLOW_DROP_OLDEST;
+  fatal("ROCTRACER_OVERFLOW_POLICY: invalid policy '%s'", policy);
+}
+
+// Configure the consumer threads shared by the memory pools if ROCTRACER_CONSUMER_THREADS (a
+// number, or "per-pool") or ROCTRACER_CONSUMER_CPUS (a comma separated list of CPUs) is set.
+void ConfigureConsumerThreads() {
+  auto threads = getenv("ROCTRACER_CONSUMER_THREADS");
+  auto cpus = getenv("ROCTRACER_CONSUMER_CPUS");
+  if (!threads && !cpus) return;
+
+  uint32_t thread_count = 0;
+  if (threads)
+    thread_count = strcmp(threads, "per-pool") == 0 ? ROCTRACER_CONSUMER_THREADS_PER_POOL
+                                                    : std::stoul(threads);
+
+  std::vector<uint32_t> cpu_list;
+  if (cpus) {
+    std::stringstream ss(cpus);
+    for (std::string cpu; std::getline(ss, cpu, ',');) cpu_list.push_back(std::stoul(cpu));
+  }
+
+  if (roctracer_configure_consumer_threads(thread_count,
+                                           cpu_list.empty() ? nullptr : cpu_list.data(),
+                                           cpu_list.size()) != ROCTRACER_STATUS_SUCCESS)
+    warning("cannot configure the consumer threads: %s", roctracer_error_string());
+}
+
 // Tracing control thread
 uint32_t control_delay_us = 0;
 uint32_t control_len_us = 0;
@@ -129,8 +227,8 @@ std::atomic_bool stop_flush_thread = false;
 
 
 void flush_thr_fun() {
+  // The activity pool is flushed periodically by its consumer threads (flush_interval_ns).
   while (!stop_flush_thread) {
-    CHECK_ROCTRACER(roctracer_flush_activity());
     roctracer::TraceBufferBase::FlushAll();
     std::this_thread::sleep_until(std::chrono::steady_clock::now() +
                                   std::chrono::microseconds(control_flush_us));
@@ -151,6 +249,11 @@ class roctracer_plugin_t {
             dlsym(plugin_handle_, "roctracer_plugin_write_callback_record"));
     if (!roctracer_plugin_write_callback_record_) return;
 
+    // Optional, the callback records are written one at a time if not implemented.
+    roctracer_plugin_write_callback_records_ =
+        reinterpret_cast<decltype(roctracer_plugin_write_callback_records)*>(
+            dlsym(plugin_handle_, "roctracer_plugin_write_callback_records"));
+
     roctracer_plugin_write_activity_records_ =
         reinterpret_cast<decltype(roctracer_plugin_write_activity_records)*>(
             dlsym(plugin_handle_, "roctracer_plugin_write_activity_records"));
@@ -177,6 +280,17 @@ class roctracer_plugin_t {
     assert(is_valid());
     return roctracer_plugin_write_callback_record_(std::forward<Args>(args)...);
   }
+  // Write the callback records of the trace entries [begin, end) with a single plugin call.
+  template <typename Entry> int write_callback_records(const Entry* begin, const Entry* end) const {
+    assert(is_valid());
+    if (roctracer_plugin_write_callback_records_ != nullptr)
+      return roctracer_plugin_write_callback_records_(&begin->record, &begin->data, end - begin,
+                                                      sizeof(Entry));
+    int status = 0;
+    for (; begin != end; ++begin)
+      status |= roctracer_plugin_write_callback_record_(&begin->record, &begin->data);
+    return status;
+  }
   template <typename... Args> auto write_activity_records(Args... args) const {
     assert(is_valid());
     return roctracer_plugin_write_activity_records_(std::forward<Args>(args)...);
@@ -188,6 +302,7 @@ class roctracer_plugin_t {
 
   decltype(roctracer_plugin_finalize)* roctracer_plugin_finalize_;
   decltype(roctracer_plugin_write_callback_record)* roctracer_plugin_write_callback_record_;
+  decltype(roctracer_plugin_write_callback_records)* roctracer_plugin_write_callback_records_;
   decltype(roctracer_plugin_write_activity_records)* roctracer_plugin_write_activity_records_;
 };
 
@@ -206,8 +321,7 @@ struct roctx_trace_entry_t {
   };
 
   roctx_trace_entry_t(uint32_t cid, roctracer_timestamp_t time, uint32_t pid, uint32_t tid,
-                      roctx_range_id_t rid, const char* message)
-      : valid(roctracer::TRACE_ENTRY_INIT) {
+                      roctx_range_id_t rid, const char* message) {
     record.domain = ACTIVITY_DOMAIN_ROCTX;
     record.op = cid;
     record.kind = 0;
@@ -224,19 +338,24 @@ struct roctx_trace_entry_t {
 };
 
 roctracer::TraceBuffer<roctx_trace_entry_t> roctx_trace_buffer(
-    "rocTX API", GetBufferSize(), [](roctx_trace_entry_t* entry) {
+    "rocTX API", GetBufferSize(),
+    [](roctx_trace_entry_t* begin, roctx_trace_entry_t* end) {
       assert(plugin && "plugin is not initialized");
-      plugin->write_callback_record(&entry->record, &entry->data);
-    });
+      plugin->write_callback_records(begin, end);
+    },
+    0, GetTraceBufferMode(),
+    [](const roctx_trace_entry_t& entry) { return entry.record.begin_ns; },
+    GetTraceFlushMode());
 
 // rocTX callback function
 void roctx_api_callback(uint32_t domain, uint32_t cid, const void* callback_data,
                         void* /* user_arg */) {
   const roctx_api_data_t* data = reinterpret_cast<const roctx_api_data_t*>(callback_data);
 
-  roctx_trace_entry_t& entry = roctx_trace_buffer.Emplace(cid, timestamp_ns(), GetPid(), GetTid(),
-                                                          data->args.id, data->args.message);
-  entry.valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+  roctx_trace_entry_t* entry = roctx_trace_buffer.TryEmplace(
+      cid, timestamp_ns(), GetPid(), GetTid(), data->args.id, data->args.message);
+  if (entry != nullptr)
+    entry->valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -250,8 +369,7 @@ struct hsa_api_trace_entry_t {
   };
 
   hsa_api_trace_entry_t(uint32_t cid, roctracer_timestamp_t begin, roctracer_timestamp_t end,
-                        uint32_t pid, uint32_t tid, const hsa_api_data_t& hsa_api_data)
-      : valid(roctracer::TRACE_ENTRY_INIT) {
+                        uint32_t pid, uint32_t tid, const hsa_api_data_t& hsa_api_data) {
     record.domain = ACTIVITY_DOMAIN_HSA_API;
     record.op = cid;
     record.kind = 0;
@@ -265,10 +383,14 @@ struct hsa_api_trace_entry_t {
 };
 
 roctracer::TraceBuffer<hsa_api_trace_entry_t> hsa_api_trace_buffer(
-    "HSA API", GetBufferSize(), [](hsa_api_trace_entry_t* entry) {
+    "HSA API", GetBufferSize(),
+    [](hsa_api_trace_entry_t* begin, hsa_api_trace_entry_t* end) {
       assert(plugin && "plugin is not initialized");
-      plugin->write_callback_record(&entry->record, &entry->data);
-    });
+      plugin->write_callback_records(begin, end);
+    },
+    0, GetTraceBufferMode(),
+    [](const hsa_api_trace_entry_t& entry) { return entry.record.end_ns; },
+    GetTraceFlushMode());
 
 // HSA API callback function
 
@@ -281,9 +403,10 @@ void hsa_api_callback(uint32_t domain, uint32_t cid, const void* callback_data,
     const roctracer_timestamp_t begin_timestamp = *data->phase_data;
     const roctracer_timestamp_t end_timestamp =
         (cid == HSA_API_ID_hsa_shut_down) ? begin_timestamp : timestamp_ns();
-    hsa_api_trace_entry_t& entry = hsa_api_trace_buffer.Emplace(cid, begin_timestamp, end_timestamp,
-                                                                GetPid(), GetTid(), *data);
-    entry.valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+    hsa_api_trace_entry_t* entry = hsa_api_trace_buffer.TryEmplace(
+        cid, begin_timestamp, end_timestamp, GetPid(), GetTid(), *data);
+    if (entry != nullptr)
+      entry->valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
   }
 }
 
@@ -299,8 +422,7 @@ struct hip_api_trace_entry_t {
 
   hip_api_trace_entry_t(uint32_t cid, roctracer_timestamp_t begin, roctracer_timestamp_t end,
                         uint32_t pid, uint32_t tid, const hip_api_data_t& hip_api_data,
-                        const char* name)
-      : valid(roctracer::TRACE_ENTRY_INIT) {
+                        const char* name) {
     record.domain = ACTIVITY_DOMAIN_HIP_API;
     record.op = cid;
     record.kind = 0;
@@ -404,10 +526,14 @@ static std::optional<std::string> getKernelName(uint32_t cid, const hip_api_data
 }
 
 roctracer::TraceBuffer<hip_api_trace_entry_t> hip_api_trace_buffer(
-    "HIP API", GetBufferSize(), [](hip_api_trace_entry_t* entry) {
+    "HIP API", GetBufferSize(),
+    [](hip_api_trace_entry_t* begin, hip_api_trace_entry_t* end) {
       assert(plugin && "plugin is not initialized");
-      plugin->write_callback_record(&entry->record, &entry->data);
-    });
+      plugin->write_callback_records(begin, end);
+    },
+    0, GetTraceBufferMode(),
+    [](const hip_api_trace_entry_t& entry) { return entry.record.end_ns; },
+    GetTraceFlushMode());
 
 void hip_api_callback(uint32_t domain, uint32_t cid, const void* callback_data, void* arg) {
   (void)arg;
@@ -421,10 +547,11 @@ void hip_api_callback(uint32_t domain, uint32_t cid, const void* callback_data,
     // Post init of HIP APU args
     hipApiArgsInit((hip_api_id_t)cid, const_cast<hip_api_data_t*>(data));
     kernel_name = getKernelName(cid, data);
-    hip_api_trace_entry_t& entry =
-        hip_api_trace_buffer.Emplace(cid, *data->phase_data, timestamp, GetPid(), GetTid(), *data,
-                                     kernel_name ? kernel_name->c_str() : nullptr);
-    entry.valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+    hip_api_trace_entry_t* entry =
+        hip_api_trace_buffer.TryEmplace(cid, *data->phase_data, timestamp, GetPid(), GetTid(),
+                                        *data, kernel_name ? kernel_name->c_str() : nullptr);
+    if (entry != nullptr)
+      entry->valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
   }
 }
 
@@ -487,8 +614,26 @@ int get_xml_array(const xml::Xml::level_t* node, const std::string& field, const
 // Allocating tracing pool
 void open_tracing_pool() {
   if (roctracer_default_pool() == nullptr) {
+    ConfigureConsumerThreads();
+
     roctracer_properties_t properties{};
     properties.buffer_size = GetBufferSize();
+    properties.buffer_count = GetBufferCount();
+    properties.mode |= GetBufferAllocationMode(&properties.numa_node);
+    properties.flush_interval_ns = control_flush_us * uint64_t{1000};
+    // Publish the activity records to a shared memory segment, drained by roctracer_collector,
+    // instead of writing them with the plugin.
+    const char* shared_memory_path = getenv("ROCTRACER_SHARED_MEMORY");
+    if (shared_memory_path != nullptr) {
+      properties.mode |= ROCTRACER_POOL_MODE_SHARED_MEMORY;
+      properties.shared_memory_path = shared_memory_path;
+    }
+    // Block the producers if not set, unless the records are published to shared memory: the
+    // collector may never attach to the segment, so the records that do not fit in it are dropped
+    // and counted instead.
+    properties.overflow_policy = GetOverflowPolicy(shared_memory_path != nullptr
+                                                       ? ROCTRACER_POOL_OVERFLOW_DROP_NEWEST
+                                                       : ROCTRACER_POOL_OVERFLOW_BLOCK);
     properties.buffer_callback_fun = [](const char* begin, const char* end, void* /* arg */) {
       assert(plugin && "plugin is not initialized");
       plugin->write_activity_records(reinterpret_cast<const roctracer_record_t*>(begin),
@@ -502,6 +647,27 @@ void open_tracing_pool() {
 void close_tracing_pool() {
   if (roctracer_pool_t* pool = roctracer_default_pool(); pool != nullptr) {
     CHECK_ROCTRACER(roctracer_flush_activity_expl(pool));
+
+    // Report the pool statistics, to help sizing the buffers (ROCTRACER_BUFFER_SIZE and
+    // ROCTRACER_BUFFER_COUNT), as a warning if records were dropped, or if ROCTRACER_POOL_STATS is
+    // set.
+    roctracer_pool_stats_t stats;
+    CHECK_ROCTRACER(roctracer_pool_get_stats(pool, &stats));
+    const char* print_stats = getenv("ROCTRACER_POOL_STATS");
+    if (stats.dropped_records != 0 || (print_stats && strcmp(print_stats, "0") != 0)) {
+      std::stringstream ss;
+      ss << "pool stats: records(" << std::dec << stats.records << "), bytes(" << stats.bytes
+         << "), flushes(" << stats.flushes << "), buffer switches(" << stats.buffer_switches
+         << "), producer wait(" << stats.producer_wait_ns / 1000 << "us), callbacks("
+         << stats.callbacks << ", " << stats.callback_ns / 1000 << "us, max "
+         << stats.max_callback_ns / 1000 << "us), max queued bytes(" << stats.max_queued_bytes
+         << "), dropped records(" << stats.dropped_records << ")";
+      if (stats.dropped_records != 0)
+        warning("%s", ss.str().c_str());
+      else
+        std::cerr << "ROCtracer: " << ss.str() << std::endl;
+    }
+
     CHECK_ROCTRACER(roctracer_close_pool_expl(pool));
   }
 }
@@ -546,6 +712,16 @@ void tool_unload() {
   // Flush tracing pool
   close_tracing_pool();
   roctracer::TraceBufferBase::FlushAll();
+
+  // Report the records dropped because a trace buffer reached its chunk limit.
+  auto report_dropped_entries = [](const auto& trace_buffer) {
+    if (uint64_t dropped = trace_buffer.dropped_entries(); dropped != 0)
+      std::cout << "ROCtracer: " << trace_buffer.name() << " trace buffer: dropped records("
+                << std::dec << dropped << ")" << std::endl;
+  };
+  report_dropped_entries(roctx_trace_buffer);
+  report_dropped_entries(hsa_api_trace_buffer);
+  report_dropped_entries(hip_api_trace_buffer);
 }
 
 // tool load method
@@ -633,6 +809,10 @@ void tool_load() {
   // Disable HIP activity if HSA activity was set
   if (trace_hsa_activity == true) trace_hip_activity = false;
 
+  SetTraceBufferLimit(roctx_trace_buffer);
+  SetTraceBufferLimit(hsa_api_trace_buffer);
+  SetTraceBufferLimit(hip_api_trace_buffer);
+
   // Enable rpcTX callbacks
   if (trace_roctx) {
     // initialize HSA tracing
@@ -0,0 +1,120 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+// Measure the cost of a correlation ID region (CorrelationIdPush and CorrelationIdPop, as done for
+// every traced API call) for 1 to N threads, and compare it with taking each ID from a single
+// global counter. The IDs handed out by the first run are checked to be unique and non-zero. The
+// results are written to stdout as JSON.
+//
+// Usage: correlation_id_bench [max threads] [regions per thread]
+
+#include "correlation_id.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace roctracer;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+size_t regions_per_thread = 1000000;
+
+// The reference: one fetch_add on a global counter per ID.
+std::atomic<uint64_t> global_counter{1};
+activity_correlation_id_t GlobalCounterPush() {
+  return global_counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Run 'regions_per_thread' regions from each thread, and return the average time per region. If
+// 'ids' is not null, store the IDs in it.
+template <typename Push, typename Pop>
+double run(size_t thread_count, Push push, Pop pop, std::vector<activity_correlation_id_t>* ids) {
+  std::vector<std::vector<activity_correlation_id_t>> thread_ids(thread_count);
+  std::vector<uint64_t> thread_ns(thread_count);
+
+  auto regions = [&](size_t thread) {
+    std::vector<activity_correlation_id_t>& samples = thread_ids[thread];
+    if (ids != nullptr) samples.reserve(regions_per_thread);
+
+    const auto start = Clock::now();
+    for (size_t i = 0; i < regions_per_thread; ++i) {
+      const activity_correlation_id_t id = push();
+      if (ids != nullptr) samples.push_back(id);
+      pop();
+    }
+    thread_ns[thread] =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t thread = 0; thread < thread_count; ++thread) threads.emplace_back(regions, thread);
+  for (auto&& thread : threads) thread.join();
+
+  if (ids != nullptr)
+    for (auto&& samples : thread_ids) ids->insert(ids->end(), samples.begin(), samples.end());
+
+  uint64_t total_ns = 0;
+  for (uint64_t ns : thread_ns) total_ns += ns;
+  return static_cast<double>(total_ns) / (thread_count * regions_per_thread);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t max_threads =
+      argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 2) regions_per_thread = std::stoul(argv[2]);
+
+  std::vector<size_t> thread_counts;
+  for (size_t threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+  thread_counts.push_back(max_threads);
+
+  // Check that the IDs are unique and non-zero.
+  std::vector<activity_correlation_id_t> ids;
+  run(max_threads, CorrelationIdPush, CorrelationIdPop, &ids);
+  std::sort(ids.begin(), ids.end());
+  if (ids.front() == 0 || std::adjacent_find(ids.begin(), ids.end()) != ids.end()) {
+    std::cerr << "correlation_id_bench: the correlation IDs are not unique" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "{\n  \"benchmark\": \"correlation_id\",\n  \"regions_per_thread\": "
+            << regions_per_thread << ",\n  \"results\": [";
+  const char* separator = "\n";
+  for (size_t threads : thread_counts) {
+    const double block_ns = run(threads, CorrelationIdPush, CorrelationIdPop, nullptr);
+    const double global_ns = run(threads, GlobalCounterPush, []() {}, nullptr);
+    std::cout << separator << "    {\"threads\": " << threads
+              << ", \"ns_per_region\": " << block_ns
+              << ", \"global_counter_ns_per_id\": " << global_ns << "}";
+    separator = ",\n";
+  }
+  std::cout << "\n  ]\n}" << std::endl;
+  return 0;
+}
@@ -0,0 +1,207 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+// Measure the MemoryPool record write cost for 1 to N producer threads, with and without data
+// copied with the records, with a fast and a slow consumer, in shared and per-thread buffers modes.
+// Each configuration is run twice: once to measure the throughput, and once timing every write to
+// report the producer stall percentiles, which include the cost of reading the clock. The results
+// are written to stdout as JSON.
+//
+// Usage: memory_pool_bench [max threads] [records per thread] [buffer size in KiB] [buffers]
+
+#include "roctracer.h"
+#include "roctracer_ext.h"
+#include "memory_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace roctracer;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Configuration {
+  uint32_t mode;
+  size_t threads;
+  size_t data_size;         // The data copied with each record.
+  uint64_t consumer_ns_kb;  // The consumer time spent per KiB of records.
+};
+
+struct Result {
+  double ns_per_record;       // Average producer time per record write.
+  double records_per_second;  // Records written by all the threads per second of wall time.
+  roctracer_pool_stats_t stats;
+  uint64_t stall_ns[5];  // The 50th, 90th, 99th, 99.9th percentiles and the maximum write time.
+};
+
+constexpr const char* kPercentileNames[] = {"p50", "p90", "p99", "p999", "max"};
+
+size_t buffer_size = 1 << 20;
+size_t buffer_count = 4;
+size_t records_per_thread = 200000;
+
+// Spin instead of sleeping, the consumer delays are much shorter than the scheduler quantum.
+void spin_for(uint64_t ns) {
+  const auto end = Clock::now() + std::chrono::nanoseconds(ns);
+  while (Clock::now() < end) {
+  }
+}
+
+// Write 'records_per_thread' records from each of the configuration's threads. If 'latencies' is
+// not null, time every write and store the times in it.
+Result run(const Configuration& configuration, std::vector<uint64_t>* latencies) {
+  roctracer_properties_t properties{};
+  properties.mode = configuration.mode;
+  properties.buffer_size = buffer_size;
+  properties.buffer_count = buffer_count;
+  properties.buffer_callback_fun = [](const char* begin, const char* end, void* arg) {
+    spin_for(*static_cast<const uint64_t*>(arg) * (end - begin) / 1024);
+  };
+  properties.buffer_callback_arg = const_cast<uint64_t*>(&configuration.consumer_ns_kb);
+
+  MemoryPool pool(properties);
+  std::vector<std::vector<uint64_t>> thread_latencies(configuration.threads);
+  std::vector<uint64_t> thread_ns(configuration.threads);
+  const std::string data(configuration.data_size, 'x');
+
+  auto write = [&](size_t thread) {
+    std::vector<uint64_t>& samples = thread_latencies[thread];
+    if (latencies != nullptr) samples.reserve(records_per_thread);
+
+    roctracer_record_t record{};
+    record.domain = ACTIVITY_DOMAIN_HIP_OPS;
+    const auto start = Clock::now();
+    for (size_t i = 0; i < records_per_thread; ++i) {
+      record.correlation_id = i;
+      const auto write_start = latencies != nullptr ? Clock::now() : Clock::time_point{};
+      if (configuration.data_size != 0)
+        pool.Write(record, data.data(), data.size(), [](auto& record, const void* data) {
+          record.kernel_name = static_cast<const char*>(data);
+        });
+      else
+        pool.Write(record);
+      if (latencies != nullptr)
+        samples.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - write_start)
+                .count());
+    }
+    thread_ns[thread] =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+  };
+
+  const auto start = Clock::now();
+  std::vector<std::thread> threads;
+  for (size_t thread = 0; thread < configuration.threads; ++thread)
+    threads.emplace_back(write, thread);
+  for (auto&& thread : threads) thread.join();
+  const double wall_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  pool.Flush();
+
+  Result result{};
+  const size_t total_records = configuration.threads * records_per_thread;
+  uint64_t total_ns = 0;
+  for (uint64_t ns : thread_ns) total_ns += ns;
+  result.ns_per_record = static_cast<double>(total_ns) / total_records;
+  result.records_per_second = total_records / wall_ns * 1e9;
+  result.stats = pool.GetStats();
+
+  if (latencies != nullptr) {
+    latencies->clear();
+    for (auto&& samples : thread_latencies)
+      latencies->insert(latencies->end(), samples.begin(), samples.end());
+    std::sort(latencies->begin(), latencies->end());
+    const double percentiles[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+    for (size_t i = 0; i < std::size(percentiles); ++i)
+      result.stall_ns[i] =
+          (*latencies)[std::min(latencies->size() - 1,
+                                static_cast<size_t>(percentiles[i] * latencies->size()))];
+  }
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t max_threads =
+      argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 2) records_per_thread = std::stoul(argv[2]);
+  if (argc > 3) buffer_size = std::stoul(argv[3]) << 10;
+  if (argc > 4) buffer_count = std::stoul(argv[4]);
+
+  const struct {
+    const char* name;
+    uint32_t mode;
+  } modes[] = {
+      {"shared", 0},
+      {"per-thread", ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS},
+  };
+  // A fast consumer does nothing with the records, a slow one processes about 1 GB/s.
+  const struct {
+    const char* name;
+    uint64_t ns_per_kb;
+  } consumers[] = {{"fast", 0}, {"slow", 1000}};
+  const size_t data_sizes[] = {0, 1024};
+
+  std::vector<size_t> thread_counts;
+  for (size_t threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+  thread_counts.push_back(max_threads);
+
+  std::cout << "{\n  \"benchmark\": \"memory_pool\",\n  \"buffer_size\": " << buffer_size
+            << ",\n  \"buffer_count\": " << buffer_count
+            << ",\n  \"records_per_thread\": " << records_per_thread << ",\n  \"results\": [";
+  const char* separator = "\n";
+  std::vector<uint64_t> latencies;
+
+  for (auto&& mode : modes)
+    for (auto&& consumer : consumers)
+      for (size_t data_size : data_sizes)
+        for (size_t threads : thread_counts) {
+          const Configuration configuration{mode.mode, threads, data_size, consumer.ns_per_kb};
+          const Result throughput = run(configuration, nullptr);
+          const Result latency = run(configuration, &latencies);
+
+          std::cout << separator << "    {\"mode\": \"" << mode.name
+                    << "\", \"threads\": " << threads << ", \"data_size\": " << data_size
+                    << ", \"consumer\": \"" << consumer.name
+                    << "\", \"ns_per_record\": " << throughput.ns_per_record
+                    << ", \"records_per_second\": " << throughput.records_per_second
+                    << ", \"producer_wait_ns\": " << throughput.stats.producer_wait_ns
+                    << ", \"buffer_switches\": " << throughput.stats.buffer_switches
+                    << ", \"dropped_records\": " << throughput.stats.dropped_records
+                    << ", \"stall_ns\": {";
+          for (size_t i = 0; i < std::size(kPercentileNames); ++i)
+            std::cout << (i != 0 ? ", " : "") << '"' << kPercentileNames[i]
+                      << "\": " << latency.stall_ns[i];
+          std::cout << "}}";
+          separator = ",\n";
+        }
+
+  std::cout << "\n  ]\n}" << std::endl;
+  return 0;
+}
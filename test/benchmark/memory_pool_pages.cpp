@@ -0,0 +1,107 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+// Compare the MemoryPool record write throughput with buffers allocated with malloc, with 4K pages
+// and with 2M pages. Usage: memory_pool_pages [buffer size in MiB] [number of buffers]
+
+#include "roctracer.h"
+#include "memory_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace roctracer;
+
+namespace {
+
+struct Result {
+  double create_ms;     // Time to create the pool, including pre-faulting the pages.
+  double write_ns;      // Average time per record write.
+  double bandwidth_gb;  // Record write bandwidth in GB/s.
+};
+
+Result run(uint32_t mode, size_t buffer_size, size_t buffer_count) {
+  std::atomic<size_t> record_count{0};
+  roctracer_properties_t properties{};
+  properties.mode = mode;
+  properties.numa_node = -1;
+  properties.buffer_size = buffer_size;
+  properties.buffer_count = buffer_count;
+  properties.buffer_callback_fun = [](const char* begin, const char* end, void* arg) {
+    *static_cast<std::atomic<size_t>*>(arg) += (end - begin) / sizeof(roctracer_record_t);
+  };
+  properties.buffer_callback_arg = &record_count;
+
+  // Write enough records to go through all the buffers twice.
+  const size_t num_records = 2 * buffer_count * (buffer_size / sizeof(roctracer_record_t));
+
+  auto start = std::chrono::steady_clock::now();
+  MemoryPool pool(properties);
+  auto created = std::chrono::steady_clock::now();
+
+  roctracer_record_t record{};
+  for (size_t i = 0; i < num_records; ++i) {
+    record.correlation_id = i;
+    pool.Write(record);
+  }
+  auto written = std::chrono::steady_clock::now();
+  pool.Flush();
+
+  if (record_count != num_records) {
+    std::cerr << "records were lost" << std::endl;
+    abort();
+  }
+
+  Result result;
+  result.create_ms = std::chrono::duration<double, std::milli>(created - start).count();
+  double write_ns = std::chrono::duration<double, std::nano>(written - created).count();
+  result.write_ns = write_ns / num_records;
+  result.bandwidth_gb = num_records * sizeof(roctracer_record_t) / write_ns;
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t buffer_size = (argc > 1 ? std::stoul(argv[1]) : 64) << 20;
+  const size_t buffer_count = argc > 2 ? std::stoul(argv[2]) : 4;
+
+  const struct {
+    const char* name;
+    uint32_t mode;
+  } configurations[] = {
+      {"malloc", 0},
+      {"4K pages", ROCTRACER_POOL_MODE_NUMA_BIND},
+      {"2M pages", ROCTRACER_POOL_MODE_NUMA_BIND | ROCTRACER_POOL_MODE_HUGE_PAGES},
+  };
+
+  std::cout << buffer_count << " buffers of " << (buffer_size >> 20) << " MiB" << std::endl;
+  for (auto&& configuration : configurations) {
+    // Warm up, then report the second run.
+    run(configuration.mode, buffer_size, buffer_count);
+    Result result = run(configuration.mode, buffer_size, buffer_count);
+    std::cout << configuration.name << ": create " << result.create_ms << " ms, write "
+              << result.write_ns << " ns/record, " << result.bandwidth_gb << " GB/s" << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,231 @@
+/* Copyright (c) 2022 Advanced Micro Devices, Inc.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE. */
+
+// Measure the TraceBuffer entry write cost (Emplace and the completion store) for 1 to N writer
+// threads, for several chunk sizes (the ROCTRACER_BUFFER_SIZE of the tracer tool), for entries the
+// size of the tracer tool's HSA and HIP API entries, in shared and sharded modes. The trace buffer
+// is flushed every millisecond by a separate thread, as with ROCP_FLUSH_RATE=1000. Each
+// configuration is run twice: once to measure the throughput and the time the writers spent
+// waiting for the next free chunk, and once timing every write to report the latency percentiles,
+// which include the cost of reading the clock. The results are written to stdout as JSON.
+//
+// Usage: trace_buffer_bench [max threads] [entries per thread] [chunk sizes, comma separated]
+
+#include "roctracer.h"
+#include "trace_buffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+TRACE_BUFFER_INSTANTIATE();
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// An entry with the layout of the tracer tool's API trace entries: the entry state, the record, and
+// the domain specific callback data copied from the API callback. The data sizes approximate the
+// sizes of hsa_api_data_t and hip_api_data_t, whose headers are not needed by this benchmark.
+template <size_t DataSize> struct Entry {
+  std::atomic<roctracer::TraceEntryState> valid;
+  roctracer_record_t record;
+  std::byte data[DataSize];
+
+  Entry(uint64_t timestamp, const std::byte* callback_data) {
+    record.domain = ACTIVITY_DOMAIN_HIP_API;
+    record.begin_ns = record.end_ns = timestamp;
+    ::memcpy(data, callback_data, DataSize);
+  }
+};
+using HsaApiEntry = Entry<128>;
+using HipApiEntry = Entry<320>;
+
+struct Configuration {
+  roctracer::TraceBufferMode mode;
+  size_t threads;
+  size_t chunk_size;  // The number of entries per chunk.
+};
+
+struct Result {
+  double ns_per_entry;        // Average writer time per entry.
+  double entries_per_second;  // Entries written by all the threads per second of wall time.
+  uint64_t free_buffer_wait_ns;  // Time the writers spent waiting for the next free chunk.
+  uint64_t latency_ns[5];  // The 50th, 90th, 99th, 99.9th percentiles and the maximum write time.
+};
+
+constexpr const char* kPercentileNames[] = {"p50", "p90", "p99", "p999", "max"};
+
+size_t entries_per_thread = 100000;
+
+// Write 'entries_per_thread' entries from each of the configuration's threads. If 'latencies' is
+// not null, time every write and store the times in it.
+template <typename Entry>
+Result run(const Configuration& configuration, std::vector<uint64_t>* latencies) {
+  uint64_t checksum = 0;
+  roctracer::TraceBuffer<Entry> trace_buffer(
+      "Benchmark", configuration.chunk_size,
+      [&checksum](Entry* begin, Entry* end) {
+        for (; begin != end; ++begin) checksum += begin->record.begin_ns;
+      },
+      0, configuration.mode);
+
+  std::atomic<bool> done{false};
+  std::thread flush_thread([&]() {
+    while (!done.load(std::memory_order_relaxed)) {
+      trace_buffer.Flush();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+
+  std::vector<std::vector<uint64_t>> thread_latencies(configuration.threads);
+  std::vector<uint64_t> thread_ns(configuration.threads);
+  const std::byte callback_data[sizeof(Entry::data)]{};
+
+  auto write = [&](size_t thread) {
+    std::vector<uint64_t>& samples = thread_latencies[thread];
+    if (latencies != nullptr) samples.reserve(entries_per_thread);
+
+    const auto start = Clock::now();
+    for (size_t i = 0; i < entries_per_thread; ++i) {
+      const auto write_start = latencies != nullptr ? Clock::now() : Clock::time_point{};
+      Entry& entry = trace_buffer.Emplace(i, callback_data);
+      entry.valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+      if (latencies != nullptr)
+        samples.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - write_start)
+                .count());
+    }
+    thread_ns[thread] =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+  };
+
+  const auto start = Clock::now();
+  std::vector<std::thread> threads;
+  for (size_t thread = 0; thread < configuration.threads; ++thread)
+    threads.emplace_back(write, thread);
+  for (auto&& thread : threads) thread.join();
+  const double wall_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+  done.store(true, std::memory_order_relaxed);
+  flush_thread.join();
+  trace_buffer.Flush();
+
+  const uint64_t expected_checksum =
+      configuration.threads * (entries_per_thread * (entries_per_thread - 1) / 2);
+  if (checksum != expected_checksum) {
+    std::cerr << "trace_buffer_bench: entries were lost" << std::endl;
+    abort();
+  }
+
+  Result result{};
+  const size_t total_entries = configuration.threads * entries_per_thread;
+  uint64_t total_ns = 0;
+  for (uint64_t ns : thread_ns) total_ns += ns;
+  result.ns_per_entry = static_cast<double>(total_ns) / total_entries;
+  result.entries_per_second = total_entries / wall_ns * 1e9;
+  result.free_buffer_wait_ns = trace_buffer.free_buffer_wait_ns();
+
+  if (latencies != nullptr) {
+    latencies->clear();
+    for (auto&& samples : thread_latencies)
+      latencies->insert(latencies->end(), samples.begin(), samples.end());
+    std::sort(latencies->begin(), latencies->end());
+    const double percentiles[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+    for (size_t i = 0; i < std::size(percentiles); ++i)
+      result.latency_ns[i] =
+          (*latencies)[std::min(latencies->size() - 1,
+                                static_cast<size_t>(percentiles[i] * latencies->size()))];
+  }
+  return result;
+}
+
+const char* separator = "\n";
+
+// Run all the configurations for the given entry type.
+template <typename Entry>
+void run_all(const char* entry_name, const std::vector<size_t>& thread_counts,
+             const std::vector<size_t>& chunk_sizes) {
+  const struct {
+    const char* name;
+    roctracer::TraceBufferMode mode;
+  } modes[] = {
+      {"shared", roctracer::TraceBufferMode::kShared},
+      {"sharded", roctracer::TraceBufferMode::kSharded},
+  };
+  std::vector<uint64_t> latencies;
+
+  for (auto&& mode : modes)
+    for (size_t chunk_size : chunk_sizes)
+      for (size_t threads : thread_counts) {
+        const Configuration configuration{mode.mode, threads, chunk_size};
+        const Result throughput = run<Entry>(configuration, nullptr);
+        const Result latency = run<Entry>(configuration, &latencies);
+
+        std::cout << separator << "    {\"entry\": \"" << entry_name
+                  << "\", \"entry_size\": " << sizeof(Entry) << ", \"mode\": \"" << mode.name
+                  << "\", \"chunk_size\": " << chunk_size << ", \"threads\": " << threads
+                  << ", \"ns_per_entry\": " << throughput.ns_per_entry
+                  << ", \"entries_per_second\": " << throughput.entries_per_second
+                  << ", \"free_buffer_wait_ns\": " << throughput.free_buffer_wait_ns
+                  << ", \"latency_ns\": {";
+        for (size_t i = 0; i < std::size(kPercentileNames); ++i)
+          std::cout << (i != 0 ? ", " : "") << '"' << kPercentileNames[i]
+                    << "\": " << latency.latency_ns[i];
+        std::cout << "}}";
+        separator = ",\n";
+      }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t max_threads =
+      argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 2) entries_per_thread = std::stoul(argv[2]);
+
+  std::vector<size_t> chunk_sizes{256, 4096, 65536};
+  if (argc > 3) {
+    chunk_sizes.clear();
+    std::stringstream ss(argv[3]);
+    for (std::string size; std::getline(ss, size, ',');) chunk_sizes.push_back(std::stoul(size));
+  }
+
+  std::vector<size_t> thread_counts;
+  for (size_t threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+  thread_counts.push_back(max_threads);
+
+  std::cout << "{\n  \"benchmark\": \"trace_buffer\",\n  \"entries_per_thread\": "
+            << entries_per_thread << ",\n  \"results\": [";
+  run_all<HsaApiEntry>("hsa_api", thread_counts, chunk_sizes);
+  run_all<HipApiEntry>("hip_api", thread_counts, chunk_sizes);
+  std::cout << "\n  ]\n}" << std::endl;
+  return 0;
+}
@@ -19,17 +19,31 @@
  THE SOFTWARE. */
 
 #include "roctracer.h"
+#include "roctracer_ext.h"
+#include "compact_record.h"
 #include "memory_pool.h"
+#include "shared_memory_ring.h"
+#include "string_table.h"
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdlib>
+#include <cstring>
 #include <iterator>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <fstream>
+#include <future>
 #include <thread>
 #include <vector>
 
+#include <unistd.h>
+
 using namespace roctracer;
 
 namespace {
@@ -42,18 +56,62 @@ const std::size_t num_cpu_cores =
 constexpr std::size_t num_iterations = 1000;
 constexpr std::size_t min_num_threads = 10;
 constexpr std::size_t max_num_threads = 50;
+constexpr std::size_t buffer_size = 10 * sizeof(roctracer_record_t);
+constexpr std::size_t max_data_size = buffer_size - sizeof(roctracer_record_t);
+constexpr std::size_t records_per_buffer = buffer_size / sizeof(roctracer_record_t);
+const std::size_t num_threads = std::clamp(num_cpu_cores, min_num_threads, max_num_threads);
 
 void fatal_error(const char* message) {
   std::cerr << message << std::endl;
   abort();
 }
 
-}  // namespace
+// Return the number of threads in this process.
+size_t thread_count() {
+  std::ifstream status("/proc/self/status");
+  for (std::string line; std::getline(status, line);)
+    if (line.rfind("Threads:", 0) == 0) return std::stoul(line.substr(8));
+  fatal_error("cannot read the thread count");
+  return 0;
+}
 
-int main() {
-  constexpr size_t buffer_size = 10 * sizeof(roctracer_record_t);
-  constexpr size_t max_data_size = buffer_size - sizeof(roctracer_record_t);
+// Return the properties of a memory pool with 'buffer_size' bytes buffers, handing the records of
+// each buffer to 'callback(begin, end)'. The callback must outlive the memory pool.
+template <typename Callback>
+roctracer_properties_t pool_properties(Callback& callback, size_t buffer_size, uint32_t mode = 0) {
+  roctracer_properties_t properties{};
+  properties.mode = mode;
+  properties.buffer_callback_fun = [](const char* begin, const char* end, void* arg) {
+    (*static_cast<Callback*>(arg))(begin, end);
+  };
+  properties.buffer_callback_arg = &callback;
+  properties.buffer_size = buffer_size;
+  return properties;
+}
+
+// Return the properties of a memory pool with 'buffer_size' bytes buffers, counting the records
+// handed to the buffer callback in 'record_count'.
+roctracer_properties_t counting_pool_properties(std::atomic<size_t>& record_count,
+                                                size_t buffer_size, uint32_t mode = 0) {
+  roctracer_properties_t properties{};
+  properties.mode = mode;
+  properties.buffer_callback_fun = [](const char* begin, const char* end, void* arg) {
+    *static_cast<std::atomic<size_t>*>(arg) += (end - begin) / sizeof(roctracer_record_t);
+  };
+  properties.buffer_callback_arg = &record_count;
+  properties.buffer_size = buffer_size;
+  return properties;
+}
+
+// Call 'function(thread)' from each of 'count' concurrent threads, and wait for them to return.
+template <typename Function> void run_threads(size_t count, Function&& function) {
+  std::vector<std::thread> threads;
+  for (size_t thread = 0; thread < count; ++thread) threads.emplace_back(function, thread);
+  for (auto&& thread : threads) thread.join();
+}
 
+// test1 to test4: writes and flushes of records with and without data.
+void test_basic_writes() {
   size_t flush_count = 0, record_count = 0;
   auto flush_callback = [&flush_count, &record_count](const char* begin, const char* end) {
     ++flush_count;
@@ -61,13 +119,7 @@ int main() {
     record_count += (end - begin) / sizeof(roctracer_record_t);
   };
 
-  roctracer_properties_t properties{};
-  properties.buffer_callback_fun = [](const char* begin, const char* end, void* arg) {
-    (*static_cast<decltype(flush_callback)*>(arg))(begin, end);
-  };
-  properties.buffer_callback_arg = &flush_callback;
-  properties.buffer_size = buffer_size;
-  MemoryPool pool(properties);
+  MemoryPool pool(pool_properties(flush_callback, buffer_size));
 
   const void* original_data;
   std::atomic<int> relocation_count{0};
@@ -92,34 +144,836 @@ int main() {
 
   flush_count = record_count = relocation_count = 0;
 
-  // test3: data does not fit in the buffer: 1 Flush, data is not relocated, all records should be
-  // processed.
+  // test3: data does not fit in the buffer: no flush until the buffer is full of records, data
+  // should get relocated to the spill arena, all records should be processed once flushed.
   constexpr char does_not_fit[max_data_size + 1] = {0};
   original_data = does_not_fit;
-  pool.Write(roctracer_record_t{}, does_not_fit, sizeof(does_not_fit), relocate_data);  // F=1, R=0
-  if (flush_count != 1 || relocation_count != 0 || record_count != 1) fatal_error("failed test3");
+  for (size_t i = 0; i < records_per_buffer; ++i)
+    pool.Write(roctracer_record_t{}, does_not_fit, sizeof(does_not_fit), relocate_data);
+  if (flush_count != 0 || relocation_count != records_per_buffer) fatal_error("failed test3");
+  pool.Flush();
+  if (flush_count != 1 || record_count != records_per_buffer) fatal_error("failed test3");
 
   flush_count = record_count = relocation_count = 0;
 
-  // test4: stress test writing and flushing.
-  const std::size_t num_threads = std::clamp(num_cpu_cores, min_num_threads, max_num_threads);
-  std::vector<std::thread> threads(num_threads);
+  // test4: stress test writing and flushing. Each thread writes 'num_iterations' records in the
+  // memory pool, then the pool is flushed once all the threads completed.
+  run_threads(num_threads, [&pool](size_t) {
+    for (std::size_t j = 0; j < num_iterations; ++j) pool.Write(roctracer_record_t{});
+  });
+  pool.Flush();
+
+  if (record_count != num_iterations * num_threads ||
+      flush_count != (record_count / (buffer_size / sizeof(roctracer_record_t))))
+    fatal_error("failed test4");
+}
+
+// test5: per-thread buffers mode, all the records written by concurrent threads should be
+// processed, and the records of the calling thread's buffer when the pool is destroyed. The write
+// cost of the shared and per-thread buffers modes is compared by the memory_pool_bench benchmark.
+void test_per_thread_buffers() {
+  std::atomic<size_t> lane_record_count{0};
+  {
+    MemoryPool lane_pool(counting_pool_properties(lane_record_count,
+                                                  num_iterations * sizeof(roctracer_record_t),
+                                                  ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS));
+    for (std::size_t count = 1; count <= num_threads; count *= 2) {
+      lane_record_count = 0;
+      run_threads(count, [&lane_pool](size_t) {
+        for (std::size_t j = 0; j < num_iterations; ++j) lane_pool.Write(roctracer_record_t{});
+      });
+      lane_pool.Flush();
+      if (lane_record_count != num_iterations * count) fatal_error("failed test5");
+    }
+
+    lane_record_count = 0;
+    lane_pool.Write(roctracer_record_t{});
+  }
+  if (lane_record_count != 1) fatal_error("failed test5");
+}
+
+// test6: N-buffer ring, producers should not wait for a slow consumer until all the buffers are
+// queued. The consumer is stalled until the writes complete, so buffer_count - 1 full buffers
+// are queued, and the records written in the last buffer are processed by the final flush.
+void test_buffer_ring() {
+  std::promise<void> consumer_gate;
+  std::shared_future<void> consumer_gate_future = consumer_gate.get_future().share();
+  std::atomic<size_t> ring_record_count{0};
+  auto ring_callback = [&consumer_gate_future, &ring_record_count](const char* begin,
+                                                                   const char* end) {
+    consumer_gate_future.wait();
+    ring_record_count += (end - begin) / sizeof(roctracer_record_t);
+  };
+
+  roctracer_properties_t ring_properties = pool_properties(ring_callback, buffer_size);
+  ring_properties.buffer_count = 4;
 
-  // Start the worker threads. Each thread will write 'num_iterations' records in the memory
-  // pool, then exit.
-  for (auto&& thread : threads) {
-    thread = std::thread([&pool]() {
-      for (std::size_t j = 0; j < num_iterations; ++j) pool.Write(roctracer_record_t{});
+  {
+    MemoryPool ring_pool(ring_properties);
+    const size_t num_records =
+        ring_properties.buffer_count * (buffer_size / sizeof(roctracer_record_t));
+    auto writer = std::async(std::launch::async, [&ring_pool, num_records]() {
+      for (size_t i = 0; i < num_records; ++i) ring_pool.Write(roctracer_record_t{});
     });
+
+    bool writer_blocked = writer.wait_for(std::chrono::seconds(10)) != std::future_status::ready;
+    consumer_gate.set_value();
+    writer.wait();
+    ring_pool.Flush();
+
+    if (writer_blocked || ring_record_count != num_records) fatal_error("failed test6");
   }
+}
 
-  // Wait for all the threads to complete, then flush the trace buffer.
-  for (auto&& thread : threads) thread.join();
-  pool.Flush();
+// test7: overflow policies, producers should not wait for a stalled consumer, and every record
+// written should either be delivered or accounted for as lost, both by the pool counter and by
+// the records lost markers. Dropping the oldest records keeps the last record written, dropping
+// the newest records loses it.
+void test_overflow_policies() {
+  for (auto policy : {ROCTRACER_POOL_OVERFLOW_DROP_NEWEST, ROCTRACER_POOL_OVERFLOW_DROP_OLDEST}) {
+    for (uint32_t mode : {0u, uint32_t{ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS}}) {
+      std::promise<void> drop_gate;
+      std::shared_future<void> drop_gate_future = drop_gate.get_future().share();
+      std::vector<activity_correlation_id_t> delivered;
+      uint64_t marker_lost_count = 0;
+      auto drop_callback = [&](const char* begin, const char* end) {
+        drop_gate_future.wait();
+        for (auto* record = reinterpret_cast<const roctracer_record_t*>(begin);
+             record < reinterpret_cast<const roctracer_record_t*>(end); ++record) {
+          if (record->domain == ACTIVITY_DOMAIN_EXT_API &&
+              record->op == ACTIVITY_EXT_OP_RECORDS_LOST) {
+            if (record->kind != ACTIVITY_DOMAIN_HIP_OPS) fatal_error("failed test7");
+            marker_lost_count += record->records_lost;
+          } else {
+            delivered.push_back(record->correlation_id);
+          }
+        }
+      };
 
-  if (record_count != num_iterations * threads.size() ||
-      flush_count != (record_count / (buffer_size / sizeof(roctracer_record_t))))
-    fatal_error("failed test4");
+      roctracer_properties_t drop_properties = pool_properties(drop_callback, buffer_size, mode);
+      drop_properties.buffer_count = 4;
+      drop_properties.overflow_policy = policy;
+
+      const size_t num_records = 10 * drop_properties.buffer_count *
+                                 (buffer_size / sizeof(roctracer_record_t));
+      uint64_t lost_count = 0;
+      {
+        MemoryPool drop_pool(drop_properties);
+        auto writer = std::async(std::launch::async, [&drop_pool, num_records]() {
+          for (size_t i = 1; i <= num_records; ++i) {
+            roctracer_record_t record{};
+            record.domain = ACTIVITY_DOMAIN_HIP_OPS;
+            record.correlation_id = i;
+            drop_pool.Write(record);
+          }
+        });
+
+        bool writer_blocked =
+            writer.wait_for(std::chrono::seconds(10)) != std::future_status::ready;
+        drop_gate.set_value();
+        writer.wait();
+        drop_pool.Flush();
+        lost_count = drop_pool.RecordsLost(ACTIVITY_DOMAIN_HIP_OPS);
+        if (writer_blocked) fatal_error("failed test7");
+      }
+
+      bool last_delivered =
+          std::find(delivered.begin(), delivered.end(), num_records) != delivered.end();
+      if (lost_count == 0 || delivered.size() + lost_count != num_records ||
+          marker_lost_count != lost_count ||
+          !std::is_sorted(delivered.begin(), delivered.end()) ||
+          last_delivered != (policy == ROCTRACER_POOL_OVERFLOW_DROP_OLDEST))
+        fatal_error("failed test7");
+    }
+  }
+}
+
+// test8: interned strings, a string is defined once per pool, and the records referring to it
+// carry its ID and point to the interned copy.
+void test_interned_strings() {
+  std::map<uint32_t, std::string> string_definitions;
+  size_t string_record_count = 0;
+  auto string_callback = [&](const char* begin, const char* end) {
+    for (auto* record = reinterpret_cast<const roctracer_record_t*>(begin);
+         record < reinterpret_cast<const roctracer_record_t*>(end); ++record) {
+      if (record->domain == ACTIVITY_DOMAIN_EXT_API &&
+          record->op == ACTIVITY_EXT_OP_STRING_DEFINITION) {
+        if (!string_definitions.emplace(record->string_id, record->string).second)
+          fatal_error("failed test8");
+      } else if (string_definitions.at(record->string_id) != record->kernel_name) {
+        fatal_error("failed test8");
+      } else {
+        ++string_record_count;
+      }
+    }
+  };
+
+  {
+    MemoryPool string_pool(pool_properties(string_callback, buffer_size));
+    const std::string kernel_names[] = {"kernel_a", "kernel_b"};
+    for (size_t i = 0; i < num_iterations; ++i) {
+      // The strings cached by the calling thread should be interned once as well.
+      auto [name, id] = i < num_iterations / 2
+          ? StringTable::Instance().Intern(kernel_names[i % 2])
+          : StringTable::Instance().InternCached(kernel_names[i % 2].c_str());
+      if (name != StringTable::Instance().Lookup(id)) fatal_error("failed test8");
+      string_pool.DefineString(id, name);
+
+      roctracer_record_t record{};
+      record.domain = ACTIVITY_DOMAIN_HIP_OPS;
+      record.kernel_name = name;
+      record.string_id = id;
+      string_pool.Write(record);
+    }
+  }
+  if (string_definitions.size() != 2 || string_record_count != num_iterations)
+    fatal_error("failed test8");
+
+  // A string cached by its address should be interned again if the address is reused for another
+  // string.
+  {
+    char reused[] = "kernel_c";
+    const uint32_t first_id = StringTable::Instance().InternCached(reused).second;
+    strcpy(reused, "kernel_d");
+    auto [name, id] = StringTable::Instance().InternCached(reused);
+    if (id == first_id || strcmp(name, "kernel_d") != 0 ||
+        StringTable::Instance().InternCached(reused).second != id)
+      fatal_error("failed test8");
+  }
+
+  // A string definition discarded by the overflow policy should be written again when the string
+  // is next used, so that the last record referring to the string follows a definition.
+  {
+    std::promise<void> string_gate;
+    std::shared_future<void> string_gate_future = string_gate.get_future().share();
+    bool string_defined = false, last_record_defined = false;
+    const size_t num_records = 10 * 4 * records_per_buffer;
+    auto discard_callback = [&](const char* begin, const char* end) {
+      string_gate_future.wait();
+      for (auto* record = reinterpret_cast<const roctracer_record_t*>(begin);
+           record < reinterpret_cast<const roctracer_record_t*>(end); ++record) {
+        if (record->domain == ACTIVITY_DOMAIN_EXT_API &&
+            record->op == ACTIVITY_EXT_OP_STRING_DEFINITION)
+          string_defined = true;
+        else if (record->domain == ACTIVITY_DOMAIN_HIP_OPS && record->correlation_id == num_records)
+          last_record_defined = string_defined;
+      }
+    };
+
+    roctracer_properties_t discard_properties = pool_properties(discard_callback, buffer_size);
+    discard_properties.buffer_count = 4;
+    discard_properties.overflow_policy = ROCTRACER_POOL_OVERFLOW_DROP_OLDEST;
+    {
+      MemoryPool discard_pool(discard_properties);
+      // Fill the first buffer, which the stalled consumer cannot discard, so that the first
+      // definition is written to a buffer the overflow policy can discard.
+      for (size_t i = 0; i < records_per_buffer; ++i) discard_pool.Write(roctracer_record_t{});
+
+      auto [name, id] = StringTable::Instance().Intern("kernel_discarded");
+      for (size_t i = 1; i <= num_records; ++i) {
+        discard_pool.DefineString(id, name);
+        roctracer_record_t record{};
+        record.domain = ACTIVITY_DOMAIN_HIP_OPS;
+        record.correlation_id = i;
+        record.kernel_name = name;
+        record.string_id = id;
+        discard_pool.Write(record);
+      }
+      string_gate.set_value();
+      discard_pool.Flush();
+    }
+    if (!last_record_defined) fatal_error("failed test8");
+  }
+}
+
+// test9: asynchronous flush, the flush should not wait for a stalled consumer, and the completion
+// callback should be called once the records written before the flush are processed.
+void test_async_flush() {
+  std::promise<void> async_gate;
+  std::shared_future<void> async_gate_future = async_gate.get_future().share();
+  std::atomic<size_t> async_record_count{0};
+  auto async_callback = [&async_gate_future, &async_record_count](const char* begin,
+                                                                  const char* end) {
+    async_gate_future.wait();
+    async_record_count += (end - begin) / sizeof(roctracer_record_t);
+  };
+
+  roctracer_properties_t async_properties = pool_properties(async_callback, buffer_size);
+
+  for (uint32_t mode : {0u, uint32_t{ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS}}) {
+    async_properties.mode = mode;
+    async_gate = std::promise<void>();
+    async_gate_future = async_gate.get_future().share();
+    async_record_count = 0;
+
+    MemoryPool async_pool(async_properties);
+    const size_t num_records = 3 * (buffer_size / sizeof(roctracer_record_t)) / 2;
+    for (size_t i = 0; i < num_records; ++i) async_pool.Write(roctracer_record_t{});
+
+    struct Completion {
+      std::promise<size_t> done;
+      std::atomic<size_t>& record_count;
+    } completion{{}, async_record_count};
+    auto done = completion.done.get_future();
+    async_pool.FlushAsync(
+        [](void* arg) {
+          auto* completion = static_cast<Completion*>(arg);
+          completion->done.set_value(completion->record_count);
+        },
+        &completion);
+
+    // The flush returned while the consumer is stalled.
+    if (done.wait_for(std::chrono::milliseconds(10)) != std::future_status::timeout)
+      fatal_error("failed test9");
+    async_gate.set_value();
+    if (done.get() != num_records) fatal_error("failed test9");
+  }
+}
+
+// test10: consumer threads, many pools should not add more consumer threads than the default of a
+// quarter of the CPUs, and the records of each pool should be processed in the order they were
+// written.
+void test_consumer_threads() {
+  constexpr size_t num_pools = 24;
+  struct PoolRecords {
+    activity_correlation_id_t last_id{0};
+    size_t count{0};
+    bool in_order{true};
+
+    void operator()(const char* begin, const char* end) {
+      for (auto* record = reinterpret_cast<const roctracer_record_t*>(begin);
+           record < reinterpret_cast<const roctracer_record_t*>(end); ++record) {
+        in_order &= record->correlation_id == last_id + 1;
+        last_id = record->correlation_id;
+        ++count;
+      }
+    }
+  };
+  std::vector<PoolRecords> pool_records(num_pools);
+
+  {
+    const size_t thread_count_before = thread_count();
+    std::vector<std::unique_ptr<MemoryPool>> pools;
+    for (auto&& records : pool_records)
+      pools.emplace_back(std::make_unique<MemoryPool>(pool_properties(records, buffer_size)));
+
+    run_threads(num_pools, [&pools](size_t pool) {
+      for (size_t i = 1; i <= num_iterations; ++i) {
+        roctracer_record_t record{};
+        record.correlation_id = i;
+        pools[pool]->Write(record);
+      }
+    });
+    const size_t max_consumer_threads = std::max(1u, std::thread::hardware_concurrency() / 4);
+    if (thread_count() > thread_count_before + max_consumer_threads) fatal_error("failed test10");
+  }
+  for (auto&& records : pool_records)
+    if (!records.in_order || records.count != num_iterations) fatal_error("failed test10");
+}
+
+// test11: periodic flush, the records should be delivered without flushing the pool although the
+// buffers are not full.
+void test_periodic_flush() {
+  for (uint32_t mode : {0u, uint32_t{ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS}}) {
+    std::atomic<size_t> periodic_record_count{0};
+    roctracer_properties_t periodic_properties =
+        counting_pool_properties(periodic_record_count, buffer_size, mode);
+    periodic_properties.flush_interval_ns = 1000000;
+
+    MemoryPool periodic_pool(periodic_properties);
+    constexpr size_t num_records = 3;
+    for (size_t i = 0; i < num_records; ++i) periodic_pool.Write(roctracer_record_t{});
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (periodic_record_count != num_records && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (periodic_record_count != num_records) fatal_error("failed test11");
+  }
+}
+
+// test12: statistics, the counters should account for every record, buffer switch and flush,
+// and for the time the producer waited for the stalled consumer. In per-thread buffers mode, the
+// last buffer is released instead of flushed since the writer thread exited.
+void test_statistics() {
+  for (uint32_t mode : {0u, uint32_t{ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS}}) {
+    std::promise<void> stats_gate;
+    std::shared_future<void> stats_gate_future = stats_gate.get_future().share();
+    auto stats_callback = [&stats_gate_future](const char*, const char*) {
+      stats_gate_future.wait();
+    };
+
+    MemoryPool stats_pool(pool_properties(stats_callback, buffer_size, mode));
+    constexpr size_t num_buffers = 5, num_records = num_buffers * records_per_buffer + 5;
+    auto writer = std::async(std::launch::async, [&stats_pool]() {
+      for (size_t i = 0; i < num_records; ++i) stats_pool.Write(roctracer_record_t{});
+    });
+
+    // The writer runs out of buffers and waits for the consumer.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    stats_gate.set_value();
+    writer.wait();
+    stats_pool.Flush();
+
+    roctracer_pool_stats_t stats = stats_pool.GetStats();
+    if (stats.records != num_records || stats.bytes != num_records * sizeof(roctracer_record_t) ||
+        stats.buffer_switches < num_buffers ||
+        stats.buffer_switches + stats.flushes != num_buffers + 1 ||
+        stats.callbacks != num_buffers + 1 || stats.producer_wait_ns == 0 ||
+        stats.max_callback_ns == 0 || stats.callback_ns < stats.max_callback_ns ||
+        stats.queued_bytes != 0 || stats.max_queued_bytes < buffer_size ||
+        stats.dropped_records != 0)
+      fatal_error("failed test12");
+  }
+}
+
+// test13: oversized data, producers should not wait for a stalled consumer to process records
+// whose data does not fit in a buffer, and the spilled data should be intact when processed.
+void test_oversized_data() {
+  for (uint32_t mode : {0u, uint32_t{ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS}}) {
+    std::promise<void> spill_gate;
+    std::shared_future<void> spill_gate_future = spill_gate.get_future().share();
+    const std::string large_name(4 * buffer_size, 'k');
+    size_t spill_record_count = 0;
+    bool spill_data_intact = true;
+    auto spill_callback = [&](const char* begin, const char* end) {
+      spill_gate_future.wait();
+      for (auto* record = reinterpret_cast<const roctracer_record_t*>(begin);
+           record < reinterpret_cast<const roctracer_record_t*>(end); ++record) {
+        spill_data_intact &= large_name == record->kernel_name;
+        ++spill_record_count;
+      }
+    };
+
+    // Less records than fit in a buffer, so that only the oversized data could make producers
+    // wait.
+    constexpr size_t num_records = records_per_buffer - 1;
+    {
+      MemoryPool spill_pool(pool_properties(spill_callback, buffer_size, mode));
+      auto writer = std::async(std::launch::async, [&spill_pool, &large_name]() {
+        for (size_t i = 0; i < num_records; ++i)
+          spill_pool.Write(roctracer_record_t{}, large_name.c_str(), large_name.size() + 1,
+                           [](roctracer_record_t& record, const void* data) {
+                             record.kernel_name = static_cast<const char*>(data);
+                           });
+      });
+
+      bool writer_blocked = writer.wait_for(std::chrono::seconds(10)) != std::future_status::ready;
+      spill_gate.set_value();
+      writer.wait();
+      spill_pool.Flush();
+      if (writer_blocked) fatal_error("failed test13");
+    }
+    if (spill_record_count != num_records || !spill_data_intact) fatal_error("failed test13");
+  }
+}
+
+// test14: reserve and commit, the records reserved together should be delivered together, and in
+// order with the records written by the same thread.
+void test_reserve_commit() {
+  for (uint32_t mode : {0u, uint32_t{ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS}}) {
+    struct ThreadRecords {
+      activity_correlation_id_t last_id{0};
+      size_t count{0};
+    };
+    std::map<uint32_t, ThreadRecords> thread_records;
+    bool pairs_intact = true;
+    auto reserve_callback = [&](const char* begin, const char* end) {
+      for (auto* record = reinterpret_cast<const roctracer_record_t*>(begin);
+           record < reinterpret_cast<const roctracer_record_t*>(end); ++record) {
+        if (record->domain == ACTIVITY_DOMAIN_EXT_API) {
+          // An external ID record is always followed by its activity record.
+          pairs_intact &= record + 1 < reinterpret_cast<const roctracer_record_t*>(end) &&
+              record[1].correlation_id == record->external_id;
+          continue;
+        }
+        auto& records = thread_records[record->thread_id];
+        pairs_intact &= record->correlation_id == records.last_id + 1;
+        records.last_id = record->correlation_id;
+        ++records.count;
+      }
+    };
+
+    {
+      MemoryPool reserve_pool(pool_properties(reserve_callback, buffer_size, mode));
+      run_threads(num_threads, [&reserve_pool](size_t t) {
+        for (size_t i = 1; i <= num_iterations; ++i) {
+          // Alternate single records written by copy and reserved record pairs.
+          if (i % 2 != 0) {
+            roctracer_record_t record{};
+            record.domain = ACTIVITY_DOMAIN_HIP_API;
+            record.correlation_id = i;
+            record.thread_id = t;
+            reserve_pool.Write(record);
+            continue;
+          }
+          roctracer_record_t* records = reserve_pool.Reserve(ACTIVITY_DOMAIN_HIP_API, 2);
+          if (records == nullptr) fatal_error("failed test14");
+          records[0].domain = ACTIVITY_DOMAIN_EXT_API;
+          records[0].external_id = i;
+          records[1].domain = ACTIVITY_DOMAIN_HIP_API;
+          records[1].correlation_id = i;
+          records[1].thread_id = t;
+          reserve_pool.Commit(records);
+        }
+      });
+    }
+
+    if (!pairs_intact || thread_records.size() != num_threads) fatal_error("failed test14");
+    for (auto&& [thread_id, records] : thread_records)
+      if (records.count != num_iterations) fatal_error("failed test14");
+  }
+
+  // Pending reservations do not hold a lock until committed, so the reserving thread can write
+  // records, flush the pool and query its statistics in between. A flush should not wait for a
+  // pending reservation: the records following it are delivered first, and the reservation once
+  // committed. A cancelled reservation should not be delivered, and the writer should not wait for
+  // the buffer holding a pending reservation.
+  for (uint32_t mode : {0u, uint32_t{ROCTRACER_POOL_MODE_COMPACT_RECORDS}}) {
+    std::mutex ids_mutex;
+    std::vector<activity_correlation_id_t> ids;
+    auto pending_callback = [&](const char* begin, const char* end) {
+      std::lock_guard lock(ids_mutex);
+      if (mode == 0) {
+        for (auto* record = reinterpret_cast<const roctracer_record_t*>(begin);
+             record < reinterpret_cast<const roctracer_record_t*>(end); ++record)
+          ids.push_back(record->correlation_id);
+      } else {
+        for (compact_record::Iterator it(begin, end, 0); it.Next();)
+          ids.push_back(it->correlation_id);
+      }
+    };
+
+    MemoryPool pending_pool(pool_properties(pending_callback, 4096, mode));
+    auto write_id = [&pending_pool](activity_correlation_id_t id) {
+      roctracer_record_t record{};
+      record.domain = ACTIVITY_DOMAIN_HIP_API;
+      record.correlation_id = id;
+      pending_pool.Write(record);
+    };
+    auto delivered = [&]() {
+      std::lock_guard lock(ids_mutex);
+      return std::exchange(ids, {});
+    };
+
+    constexpr activity_correlation_id_t last_id = 20;
+    write_id(1);
+    roctracer_record_t* records = pending_pool.ReservePending(ACTIVITY_DOMAIN_HIP_API, 2);
+    if (records == nullptr) fatal_error("failed test14");
+    for (activity_correlation_id_t id = 4; id <= last_id; ++id) write_id(id);
+    if (pending_pool.GetStats().records != last_id) fatal_error("failed test14");
+
+    // Flushing from the reserving thread should not wait for the reservation.
+    pending_pool.Flush();
+    std::vector<activity_correlation_id_t> expected{1};
+    for (activity_correlation_id_t id = 4; id <= last_id; ++id) expected.push_back(id);
+    if (delivered() != expected) fatal_error("failed test14");
 
+    for (activity_correlation_id_t id : {2, 3}) {
+      records[id - 2].domain = ACTIVITY_DOMAIN_HIP_API;
+      records[id - 2].correlation_id = id;
+    }
+    if (!pending_pool.CommitPending(records) || pending_pool.CommitPending(records))
+      fatal_error("failed test14");
+    pending_pool.Flush();
+    // The consumer delivers the committed reservation asynchronously.
+    for (int i = 0; i < 1000 && delivered() != std::vector<activity_correlation_id_t>{2, 3}; ++i)
+      if (i == 999) fatal_error("failed test14");
+      else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // Cancel a reservation, while writing enough records after it to cycle through all the
+    // buffers with the blocking overflow policy.
+    records = pending_pool.ReservePending(ACTIVITY_DOMAIN_HIP_API, 2);
+    if (records == nullptr) fatal_error("failed test14");
+    const size_t num_records = 4 * 4096 / sizeof(roctracer_record_t);
+    auto writes = std::async(std::launch::async, [&]() {
+      for (size_t i = 0; i < num_records; ++i) write_id(last_id + 1 + i);
+      pending_pool.Flush();
+    });
+    if (writes.wait_for(std::chrono::seconds(10)) != std::future_status::ready)
+      fatal_error("failed test14");
+    if (!pending_pool.CancelPending(records) || pending_pool.CommitPending(records))
+      fatal_error("failed test14");
+    pending_pool.Flush();
+    if (delivered().size() != num_records ||
+        pending_pool.GetStats().records != last_id + num_records)
+      fatal_error("failed test14");
+  }
+}
+
+// test15: compact records, the records should be decoded as written, including the reserved
+// records, the records lost markers and the data copied to the buffers, in less than half the
+// space of the standard records.
+void test_compact_records() {
+  for (uint32_t mode : {0u, uint32_t{ROCTRACER_POOL_MODE_PER_THREAD_BUFFERS}}) {
+    constexpr uint64_t time_base_ns = 1'000'000'000'000;
+    std::vector<roctracer_record_t> expected, decoded;
+    size_t compact_size = 0;
+    auto compact_callback = [&](const char* begin, const char* end) {
+      compact_size += end - begin;
+      for (compact_record::Iterator it(begin, end, time_base_ns); it.Next();) {
+        roctracer_record_t record = *it;
+        // The data copied to the buffers is compared by value.
+        if (record.domain == ACTIVITY_DOMAIN_EXT_API &&
+            record.op == ACTIVITY_EXT_OP_STRING_DEFINITION) {
+          if (strcmp(record.string, "kernel") != 0) fatal_error("failed test15");
+          record.string = nullptr;
+        }
+        decoded.push_back(record);
+      }
+    };
+
+    roctracer_properties_t compact_properties =
+        pool_properties(compact_callback, 4096, mode | ROCTRACER_POOL_MODE_COMPACT_RECORDS);
+    compact_properties.time_base_ns = time_base_ns;
+
+    {
+      MemoryPool compact_pool(compact_properties);
+      for (size_t i = 0; i < num_iterations; ++i) {
+        roctracer_record_t record{};
+        record.correlation_id = i + 1;
+        record.begin_ns = time_base_ns + i * 1000;
+        record.end_ns = record.begin_ns + 500;
+        switch (i % 4) {
+          case 0:
+            record.domain = ACTIVITY_DOMAIN_HIP_API;
+            record.op = i % 400;
+            record.process_id = 1234;
+            record.thread_id = 5678;
+            compact_pool.Write(record);
+            break;
+          case 1:
+            record.domain = ACTIVITY_DOMAIN_HIP_OPS;
+            record.op = 1;
+            record.device_id = -1;
+            record.queue_id = 3;
+            record.bytes = i * 4096;
+            compact_pool.Write(record);
+            break;
+          case 2: {
+            // Timestamps before the time base, and large op IDs.
+            record.domain = ACTIVITY_DOMAIN_HSA_OPS;
+            record.op = 0x12345;
+            record.begin_ns = time_base_ns - i;
+            record.end_ns = 0;
+            record.kernel_name = "kernel";
+            record.string_id = 7;
+            compact_pool.Write(record);
+            break;
+          }
+          case 3: {
+            roctracer_record_t* records = compact_pool.Reserve(ACTIVITY_DOMAIN_HIP_API, 2);
+            records[0].domain = ACTIVITY_DOMAIN_EXT_API;
+            records[0].op = ACTIVITY_EXT_OP_EXTERN_ID;
+            records[0].correlation_id = record.correlation_id;
+            records[0].external_id = ~uint64_t{0};
+            record.domain = ACTIVITY_DOMAIN_HIP_API;
+            records[1] = record;
+            expected.push_back(records[0]);
+            compact_pool.Commit(records);
+            break;
+          }
+        }
+        expected.push_back(record);
+
+        // The string is copied to the buffer.
+        if (i == 0) {
+          compact_pool.DefineString(42, "kernel");
+          roctracer_record_t definition{};
+          definition.domain = ACTIVITY_DOMAIN_EXT_API;
+          definition.op = ACTIVITY_EXT_OP_STRING_DEFINITION;
+          definition.string_id = 42;
+          expected.push_back(definition);
+        }
+      }
+    }
+
+    auto same_record = [](const roctracer_record_t& a, const roctracer_record_t& b) {
+      constexpr size_t union_offset = offsetof(roctracer_record_t, device_id);
+      return a.domain == b.domain && a.kind == b.kind && a.op == b.op &&
+          a.correlation_id == b.correlation_id && a.begin_ns == b.begin_ns &&
+          a.end_ns == b.end_ns &&
+          memcmp(reinterpret_cast<const char*>(&a) + union_offset,
+                 reinterpret_cast<const char*>(&b) + union_offset,
+                 sizeof(roctracer_record_t) - union_offset) == 0;
+    };
+    if (!std::equal(decoded.begin(), decoded.end(), expected.begin(), expected.end(),
+                    same_record) ||
+        compact_size * 2 > expected.size() * sizeof(roctracer_record_t))
+      fatal_error("failed test15");
+  }
+}
+
+// test16: shared memory, a reader attached to the segment should receive the records in order,
+// with the defined strings, until the pool is closed. Without a reader, the records should be
+// dropped instead of blocking the producer, and the records published before should remain
+// readable.
+void test_shared_memory() {
+  for (uint32_t mode : {0u, uint32_t{ROCTRACER_POOL_MODE_COMPACT_RECORDS}}) {
+    char path[] = "/tmp/roctracer_shm_XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd == -1) fatal_error("failed test16: cannot create the segment file");
+    close(fd);
+
+    // Call 'function' with each record of the chunk, and the string following string definitions.
+    auto for_each_record = [](const SharedMemoryRing& ring, const std::byte* begin,
+                              const std::byte* end, auto&& function) {
+      while (begin < end) {
+        roctracer_record_t record;
+        if ((ring.flags() & ROCTRACER_SHM_FLAG_COMPACT_RECORDS) != 0) {
+          begin = compact_record::Decode(begin, end, ring.time_base_ns(), &record);
+          if (begin == nullptr) fatal_error("failed test16: malformed record");
+        } else {
+          memcpy(&record, begin, sizeof(record));
+          begin += sizeof(record);
+        }
+        const char* string = nullptr;
+        if (record.domain == ACTIVITY_DOMAIN_EXT_API &&
+            record.op == ACTIVITY_EXT_OP_STRING_DEFINITION) {
+          string = reinterpret_cast<const char*>(begin);
+          begin += (strlen(string) + 8) & ~size_t{7};
+        }
+        function(record, string);
+      }
+    };
+
+    roctracer_properties_t shm_properties{};
+    shm_properties.mode = mode | ROCTRACER_POOL_MODE_SHARED_MEMORY;
+    shm_properties.buffer_size = 4096;
+    shm_properties.shared_memory_path = path;
+
+    {
+      auto shm_pool = std::make_unique<MemoryPool>(shm_properties);
+      std::thread reader([&]() {
+        SharedMemoryRing ring(path);
+        uint64_t next_id = 1;
+        bool string_defined = false;
+        for (bool closed = false; !closed;) {
+          closed = ring.closed();
+          ring.Consume([&](const std::byte* begin, const std::byte* end) {
+            for_each_record(ring, begin, end, [&](auto&& record, const char* string) {
+              if (string != nullptr)
+                string_defined = record.string_id == 42 && strcmp(string, "kernel") == 0;
+              else if (record.correlation_id != next_id++)
+                fatal_error("failed test16: records out of order");
+            });
+          });
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        if (next_id != 10 * num_iterations + 1 || !string_defined || ring.records_lost() != 0)
+          fatal_error("failed test16");
+      });
+
+      for (size_t i = 0; i < 10 * num_iterations; ++i) {
+        if (i == 0) shm_pool->DefineString(42, "kernel");
+        roctracer_record_t record{};
+        record.domain = ACTIVITY_DOMAIN_HIP_API;
+        record.correlation_id = i + 1;
+        shm_pool->Write(record);
+      }
+      shm_pool.reset();
+      reader.join();
+    }
+
+    // Without a reader, the ring fills up and the records are dropped. The pool is flushed after
+    // each buffer, so that most records are dropped by the ring rather than by the pool.
+    shm_properties.buffer_size = buffer_size;
+    shm_properties.overflow_policy = ROCTRACER_POOL_OVERFLOW_DROP_NEWEST;
+    uint64_t records_lost;
+    {
+      MemoryPool shm_pool(shm_properties);
+      for (size_t i = 0; i < num_iterations; ++i) {
+        roctracer_record_t record{};
+        record.domain = ACTIVITY_DOMAIN_HIP_API;
+        shm_pool.Write(record);
+        if (i % records_per_buffer == records_per_buffer - 1) shm_pool.Flush();
+      }
+      shm_pool.Flush();
+      records_lost = shm_pool.RecordsLost(ACTIVITY_DOMAIN_HIP_API);
+    }
+
+    SharedMemoryRing ring(path);
+    size_t record_count = 0;
+    ring.Consume([&](const std::byte* begin, const std::byte* end) {
+      for_each_record(ring, begin, end, [&](auto&& record, const char*) {
+        if (record.domain == ACTIVITY_DOMAIN_HIP_API) ++record_count;
+      });
+    });
+    if (ring.records_lost() == 0 || ring.records_lost() > records_lost ||
+        record_count + records_lost != num_iterations || !ring.closed())
+      fatal_error("failed test16");
+
+    // With the blocking policy and no reader, the consumer waits for the reader once, then drops
+    // the records instead of stalling the flushes and the destruction of the pool.
+    shm_properties.overflow_policy = ROCTRACER_POOL_OVERFLOW_BLOCK;
+    auto closed = std::async(std::launch::async, [&]() {
+      MemoryPool shm_pool(shm_properties);
+      for (size_t i = 0; i < num_iterations; ++i) {
+        roctracer_record_t record{};
+        record.domain = ACTIVITY_DOMAIN_HIP_API;
+        shm_pool.Write(record);
+        if (i % records_per_buffer == records_per_buffer - 1) shm_pool.Flush();
+      }
+      shm_pool.Flush();
+      return shm_pool.RecordsLost(ACTIVITY_DOMAIN_HIP_API);
+    });
+    if (closed.wait_for(std::chrono::seconds(10)) != std::future_status::ready)
+      fatal_error("failed test16: the pool is stalled without a reader");
+    records_lost = closed.get();
+    SharedMemoryRing stalled_ring(path);
+    if (records_lost == 0 || stalled_ring.records_lost() == 0 || !stalled_ring.closed())
+      fatal_error("failed test16");
+    unlink(path);
+  }
+}
+
+// test17: consumer threads, with a consumer thread per pool, a stalled buffer callback should not
+// delay the consumer of another pool, whose producers wait for it with the blocking overflow
+// policy.
+void test_stalled_consumer() {
+  // The consumer threads are stopped since no pool is left from the previous tests.
+  if (!ConsumerExecutor::Instance().Configure(ConsumerExecutor::kThreadPerTask, {}))
+    fatal_error("failed test17: cannot configure the consumer threads");
+
+  std::promise<void> release_stalled;
+  std::shared_future<void> stalled_released = release_stalled.get_future().share();
+  auto stalled_callback = [&stalled_released](const char*, const char*) {
+    stalled_released.wait();
+  };
+  MemoryPool stalled_pool(pool_properties(stalled_callback, buffer_size));
+  stalled_pool.Write(roctracer_record_t{});
+  stalled_pool.FlushAsync(nullptr, nullptr);
+
+  auto blocking_callback = [](const char*, const char*) {};
+  roctracer_properties_t blocking_properties = pool_properties(blocking_callback, buffer_size);
+  blocking_properties.overflow_policy = ROCTRACER_POOL_OVERFLOW_BLOCK;
+  MemoryPool blocking_pool(blocking_properties);
+
+  auto writes = std::async(std::launch::async, [&blocking_pool]() {
+    for (size_t i = 0; i < num_iterations; ++i) blocking_pool.Write(roctracer_record_t{});
+    blocking_pool.Flush();
+  });
+  const bool delayed = writes.wait_for(std::chrono::seconds(10)) != std::future_status::ready;
+  release_stalled.set_value();
+  writes.wait();
+  if (delayed) fatal_error("failed test17");
+}
+
+}  // namespace
+
+int main() {
+  test_basic_writes();
+  test_per_thread_buffers();
+  test_buffer_ring();
+  test_overflow_policies();
+  test_interned_strings();
+  test_async_flush();
+  test_consumer_threads();
+  test_periodic_flush();
+  test_statistics();
+  test_oversized_data();
+  test_reserve_commit();
+  test_compact_records();
+  test_shared_memory();
+  test_stalled_consumer();
   return 0;
-}
\ No newline at end of file
+}
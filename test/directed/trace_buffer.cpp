@@ -34,6 +34,12 @@ struct TraceEntry {
   std::atomic<roctracer::TraceEntryState> valid;
 };
 
+struct TimedTraceEntry {
+  std::atomic<roctracer::TraceEntryState> valid;
+  uint64_t timestamp;
+  explicit TimedTraceEntry(uint64_t timestamp) : timestamp(timestamp) {}
+};
+
 TRACE_BUFFER_INSTANTIATE();
 
 namespace {
@@ -75,5 +81,171 @@ int main() {
   std::cout << "number of records flushed = " << flush_count << std::endl;
   if (flush_count != num_iterations * threads.size()) abort();
 
+  // Write and flush the trace buffer repeatedly, so that the flushed chunks are recycled. The
+  // recycled chunks' entries should be invalid until written again.
+  constexpr std::size_t num_rounds = 10;
+  for (std::size_t round = 0; round < num_rounds; ++round) {
+    flush_count = 0;
+    for (auto&& thread : threads) {
+      thread = std::thread([&trace_buffer]() {
+        for (std::size_t j = 0; j < num_iterations; ++j) {
+          auto& entry = trace_buffer.Emplace();
+          entry.valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+        }
+      });
+    }
+    for (auto&& thread : threads) thread.join();
+    trace_buffer.Flush();
+    if (flush_count != num_iterations * threads.size()) abort();
+  }
+
+  // Flush when the write pointer is exactly at the end of a chunk, then keep writing: the entries
+  // of the next chunk must be flushed, and not the already flushed entries of the previous one.
+  {
+    uint64_t written = 0, flushed = 0;
+    roctracer::TraceBuffer<TimedTraceEntry> chunk_end_buffer(
+        "Chunk end", 10, [&flushed](auto* entry) { flushed += entry->timestamp; });
+    for (uint64_t id = 1; id <= 30; ++id) {
+      auto& entry = chunk_end_buffer.Emplace(id);
+      entry.valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+      written += id;
+      if (id % 10 == 0) chunk_end_buffer.Flush();
+    }
+    if (flushed != written) abort();
+  }
+
+  // Span flush callback: the complete entries of a chunk are flushed with a single invocation.
+  {
+    std::size_t span_count = 0, entry_count = 0;
+    roctracer::TraceBuffer<TraceEntry> span_buffer("Spans", 10, [&](auto* begin, auto* end) {
+      ++span_count;
+      entry_count += end - begin;
+    });
+    for (std::size_t i = 0; i < 95; ++i)
+      span_buffer.Emplace().valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+    span_buffer.Flush();
+    if (span_count != 10 || entry_count != 95) abort();
+  }
+
+  // Chunk limit, drop policy: once the limit is reached, the entries are dropped until a flush
+  // releases chunks. The chunk being written does not count towards the limit.
+  {
+    std::size_t count = 0;
+    roctracer::TraceBuffer<TraceEntry> limited_buffer("Drop", 10, [&count](auto*) { ++count; });
+    limited_buffer.SetChunkLimit(2, roctracer::TraceOverflowPolicy::kDrop);
+    for (std::size_t i = 0; i < 100; ++i)
+      if (auto* entry = limited_buffer.TryEmplace(); entry != nullptr)
+        entry->valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+    limited_buffer.Flush();
+    if (count != 30 || limited_buffer.dropped_entries() != 70) abort();
+  }
+
+  // Chunk limit, flush policy: the writer flushes the trace buffer itself when the limit is
+  // reached, so no entries are dropped.
+  {
+    std::size_t count = 0;
+    roctracer::TraceBuffer<TraceEntry> limited_buffer("Flush", 10, [&count](auto*) { ++count; });
+    limited_buffer.SetChunkLimit(1, roctracer::TraceOverflowPolicy::kFlush);
+    for (std::size_t i = 0; i < num_iterations; ++i)
+      limited_buffer.TryEmplace()->valid.store(roctracer::TRACE_ENTRY_COMPLETE,
+                                               std::memory_order_release);
+    if (count < num_iterations - 20 || limited_buffer.dropped_entries() != 0) abort();
+    limited_buffer.Flush();
+    if (count != num_iterations) abort();
+  }
+
+  // Chunk limit, block policy: the writers wait for the flushing thread to release chunks, in the
+  // shared and in the sharded modes.
+  for (auto mode : {roctracer::TraceBufferMode::kShared, roctracer::TraceBufferMode::kSharded}) {
+    std::atomic<std::size_t> count{0};
+    roctracer::TraceBuffer<TraceEntry> limited_buffer(
+        "Block", 10, [&count](auto*) { ++count; }, 0, mode);
+    limited_buffer.SetChunkLimit(4, roctracer::TraceOverflowPolicy::kBlock);
+
+    std::atomic<bool> done{false};
+    std::thread flush_thread([&]() {
+      while (!done) limited_buffer.Flush();
+    });
+    for (auto&& thread : threads) {
+      thread = std::thread([&limited_buffer]() {
+        for (std::size_t j = 0; j < num_iterations; ++j)
+          limited_buffer.TryEmplace()->valid.store(roctracer::TRACE_ENTRY_COMPLETE,
+                                                   std::memory_order_release);
+      });
+    }
+    for (auto&& thread : threads) thread.join();
+    done = true;
+    flush_thread.join();
+    limited_buffer.Flush();
+    if (count != num_iterations * threads.size() || limited_buffer.dropped_entries() != 0) abort();
+  }
+
+  // Sharded mode: each thread writes to its own shard, the shards are merged by the flush in
+  // timestamp order, and the shards of the exited threads are released.
+  std::atomic<uint64_t> clock{0};
+  uint64_t last_timestamp = 0;
+  bool ordered = true;
+  flush_count = 0;
+  roctracer::TraceBuffer<TimedTraceEntry> sharded_buffer(
+      "Sharded", 10,
+      [&](auto* entry) {
+        ordered = ordered && entry->timestamp >= last_timestamp;
+        last_timestamp = entry->timestamp;
+        ++flush_count;
+      },
+      0, roctracer::TraceBufferMode::kSharded, [](auto& entry) { return entry.timestamp; });
+
+  for (std::size_t round = 0; round < num_rounds; ++round) {
+    last_timestamp = 0;
+    for (auto&& thread : threads) {
+      thread = std::thread([&sharded_buffer, &clock]() {
+        for (std::size_t j = 0; j < num_iterations; ++j) {
+          auto& entry = sharded_buffer.Emplace(++clock);
+          entry.valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+        }
+      });
+    }
+    for (auto&& thread : threads) thread.join();
+    sharded_buffer.Flush();
+  }
+  if (!ordered || flush_count != num_rounds * num_iterations * threads.size()) abort();
+
+  // Skip-incomplete flush mode: an entry left incomplete does not hold back the entries written
+  // after it, and is flushed once complete. Every entry must be flushed exactly once.
+  std::atomic<uint64_t> next_id{1}, written_ids{0};
+  uint64_t flushed_ids = 0;
+  flush_count = 0;
+  roctracer::TraceBuffer<TimedTraceEntry> skipping_buffer(
+      "Skipping", 10,
+      [&](auto* entry) {
+        flushed_ids += entry->timestamp;
+        ++flush_count;
+      },
+      0, roctracer::TraceBufferMode::kShared, {}, roctracer::TraceFlushMode::kSkipIncomplete);
+
+  auto& incomplete_entry = skipping_buffer.Emplace(next_id++);
+  for (std::size_t round = 0; round < num_rounds; ++round) {
+    for (auto&& thread : threads) {
+      thread = std::thread([&skipping_buffer, &next_id, &written_ids]() {
+        for (std::size_t j = 0; j < num_iterations; ++j) {
+          const uint64_t id = next_id++;
+          auto& entry = skipping_buffer.Emplace(id);
+          entry.valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+          written_ids += id;
+        }
+      });
+    }
+    for (auto&& thread : threads) thread.join();
+    skipping_buffer.Flush();
+    if (flush_count != (round + 1) * num_iterations * threads.size() || flushed_ids != written_ids)
+      abort();
+  }
+
+  incomplete_entry.valid.store(roctracer::TRACE_ENTRY_COMPLETE, std::memory_order_release);
+  skipping_buffer.Flush();
+  if (flush_count != num_rounds * num_iterations * threads.size() + 1 ||
+      flushed_ids != written_ids + 1)
+    abort();
+
   return EXIT_SUCCESS;
 }
\ No newline at end of file